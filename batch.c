@@ -0,0 +1,387 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <gmp.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// header files
+#include "batch.h"
+#include "pool.h"
+#include "ss.h"
+
+// blocks per scheduled segment
+#define SEG_BLOCKS 256
+
+// segments of one file in flight per worker; finished segments wait in memory
+// until every earlier one is written, so this bounds that memory
+#define SEG_WINDOW 2
+
+typedef struct file file_t;
+
+typedef struct {
+    file_t *file;
+    size_t index;
+    uint8_t *out; // ciphertext, until it is written
+    size_t len;
+    bool done;
+} segment_t;
+
+typedef struct {
+    mpz_srcptr n;
+    uint64_t span; // plaintext bytes per segment
+    pool_t *pool;
+    size_t window; // most segments of a file submitted but not yet written
+} batch_t;
+
+struct file {
+    const batch_t *batch;
+    const char *path;
+    char *outpath;
+    uint64_t size;
+    size_t nseg;
+    segment_t *segs;
+
+    pthread_mutex_t lock; // guards the fields below
+    size_t committed; // segments written to out so far
+    size_t submitted; // segments handed to the pool so far
+    FILE *out;
+    bool created; // out was opened, so a failed file leaves something to remove
+    int error; // first errno seen
+    double start, end; // seconds, from the first segment started to the last written
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fail(file_t *f, int error) {
+    if (f->error == 0) {
+        f->error = error;
+    }
+}
+
+static void encrypt_segment(void *arg);
+
+//
+// Moves the window of f forward, returning the segments that now fit in it as
+// [*from, return value); f->lock must be held
+//
+static size_t advance(file_t *f, size_t *from) {
+    *from = f->submitted;
+    while (f->submitted < f->nseg && f->submitted - f->committed < f->batch->window) {
+        f->submitted++;
+    }
+    return f->submitted;
+}
+
+//
+// Stores a finished segment, writes out every segment that is now next in line
+// and submits the segments that the written ones made room for
+//
+static void commit(segment_t *seg) {
+    file_t *f = seg->file;
+
+    pthread_mutex_lock(&f->lock);
+    seg->done = true;
+    while (f->committed < f->nseg && f->segs[f->committed].done) {
+        segment_t *s = &f->segs[f->committed];
+        if (f->error == 0 && f->out == NULL) {
+            f->out = fopen(f->outpath, "w");
+            if (f->out == NULL) {
+                fail(f, errno);
+            }
+            f->created = f->out != NULL;
+        }
+        if (f->error == 0 && fwrite(s->out, sizeof(uint8_t), s->len, f->out) != s->len) {
+            fail(f, errno);
+        }
+        free(s->out);
+        s->out = NULL;
+        f->committed++;
+    }
+
+    if (f->committed == f->nseg) {
+        if (f->out != NULL && fclose(f->out) != 0) {
+            fail(f, errno);
+        }
+        f->out = NULL;
+        f->end = now();
+    }
+    size_t from, to = advance(f, &from);
+    pthread_mutex_unlock(&f->lock);
+
+    for (size_t i = from; i < to; i++) {
+        pool_submit(f->batch->pool, encrypt_segment, &f->segs[i]);
+    }
+}
+
+static bool read_at(int fd, uint8_t *buf, size_t len, uint64_t off) {
+    while (len > 0) {
+        ssize_t got = pread(fd, buf, len, (off_t) off);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            errno = got == 0 ? EIO : errno; // file shrank under us
+            return false;
+        }
+        buf += got;
+        len -= (size_t) got;
+        off += (uint64_t) got;
+    }
+    return true;
+}
+
+//
+// Pool task: encrypts one segment of a file
+//
+static void encrypt_segment(void *arg) {
+    segment_t *seg = arg;
+    file_t *f = seg->file;
+    const batch_t *batch = f->batch;
+
+    pthread_mutex_lock(&f->lock);
+    if (f->start == 0) {
+        f->start = now();
+    }
+    bool failed = f->error != 0;
+    pthread_mutex_unlock(&f->lock);
+
+    uint64_t off = seg->index * batch->span;
+    size_t len = f->size - off < batch->span ? f->size - off : batch->span;
+    size_t cap = ss_encrypt_buffer_size(len, batch->n);
+    uint8_t *in = NULL;
+    int fd = -1, error = 0;
+
+    if (!failed) {
+        in = malloc(len);
+        seg->out = malloc(cap);
+        if (in == NULL || seg->out == NULL) {
+            error = ENOMEM;
+        } else if ((fd = open(f->path, O_RDONLY)) < 0 || !read_at(fd, in, len, off)) {
+            error = errno;
+        } else {
+            ss_encrypt_buffer(seg->out, cap, &seg->len, in, len, batch->n);
+        }
+    }
+    if (error != 0) {
+        pthread_mutex_lock(&f->lock);
+        fail(f, error);
+        pthread_mutex_unlock(&f->lock);
+        free(seg->out);
+        seg->out = NULL;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(in);
+
+    commit(seg);
+}
+
+static void add_path(char ***paths, size_t *count, size_t *cap, char *path) {
+    if (*count == *cap) {
+        *cap = *cap ? 2 * *cap : 64;
+        *paths = realloc(*paths, *cap * sizeof(char *));
+    }
+    (*paths)[(*count)++] = path;
+}
+
+static bool is_output(const char *name) {
+    size_t len = strlen(name);
+    return len >= 4 && strcmp(name + len - 4, ".enc") == 0;
+}
+
+//
+// Adds every regular file below dir, skipping hidden entries and earlier outputs
+//
+static bool walk(const char *dir, char ***paths, size_t *count, size_t *cap) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return false;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.' || is_output(entry->d_name)) {
+            continue;
+        }
+
+        char *path = malloc(strlen(dir) + strlen(entry->d_name) + 2);
+        sprintf(path, "%s/%s", dir, entry->d_name);
+
+        struct stat st;
+        if (lstat(path, &st) != 0) {
+            free(path);
+        } else if (S_ISDIR(st.st_mode)) {
+            walk(path, paths, count, cap);
+            free(path);
+        } else if (S_ISREG(st.st_mode)) {
+            add_path(paths, count, cap, path);
+        } else {
+            free(path);
+        }
+    }
+    closedir(d);
+    return true;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+//
+// Collects the files to encrypt from a directory or a list file.
+//
+bool batch_collect(const char *path, char ***paths, size_t *count) {
+    size_t cap = 0;
+    *paths = NULL;
+    *count = 0;
+
+    struct stat st;
+    if (strcmp(path, "-") != 0 && stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        if (!walk(path, paths, count, &cap)) {
+            return false;
+        }
+        qsort(*paths, *count, sizeof(char *), compare_paths);
+        return true;
+    }
+
+    FILE *list = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (list == NULL) {
+        return false;
+    }
+
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &linecap, list)) > 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (len > 0) {
+            add_path(paths, count, &cap, strdup(line));
+        }
+    }
+    free(line);
+    if (list != stdin) {
+        fclose(list);
+    }
+    return true;
+}
+
+//
+// Encrypts count files to <file>.enc.
+//
+size_t batch_encrypt(char *paths[], size_t count, const mpz_t n, size_t nthreads, bool verbose) {
+    batch_t batch = { .n = n, .span = SEG_BLOCKS * (ss_block_size(n) - 1) };
+    file_t *files = calloc(count, sizeof(file_t));
+    double start = now();
+
+    pool_t *pool = files != NULL ? pool_create(nthreads) : NULL;
+    if (pool == NULL) {
+        fprintf(stderr, "batch: could not start worker threads\n");
+        free(files);
+        return count;
+    }
+    batch.pool = pool;
+    batch.window = SEG_WINDOW * pool_size(pool);
+
+    for (size_t i = 0; i < count; i++) {
+        file_t *f = &files[i];
+        f->batch = &batch;
+        f->path = paths[i];
+        f->outpath = malloc(strlen(paths[i]) + 5);
+        pthread_mutex_init(&f->lock, NULL);
+        if (f->outpath == NULL) {
+            fail(f, ENOMEM);
+            continue;
+        }
+        sprintf(f->outpath, "%s.enc", paths[i]);
+
+        struct stat st;
+        if (stat(f->path, &st) != 0) {
+            fail(f, errno);
+            continue;
+        }
+        f->size = (uint64_t) st.st_size;
+        f->nseg = (f->size + batch.span - 1) / batch.span;
+
+        // an empty file still gets its (empty) ciphertext
+        if (f->nseg == 0) {
+            f->start = now();
+            FILE *out = fopen(f->outpath, "w");
+            if (out == NULL || fclose(out) != 0) {
+                fail(f, errno);
+            }
+            f->end = now();
+            continue;
+        }
+
+        f->segs = calloc(f->nseg, sizeof(segment_t));
+        if (f->segs == NULL) {
+            fail(f, ENOMEM);
+            continue;
+        }
+        for (size_t s = 0; s < f->nseg; s++) {
+            f->segs[s] = (segment_t) { .file = f, .index = s };
+        }
+
+        // the rest follow as written segments make room
+        pthread_mutex_lock(&f->lock);
+        size_t from, to = advance(f, &from);
+        pthread_mutex_unlock(&f->lock);
+        for (size_t s = from; s < to; s++) {
+            pool_submit(pool, encrypt_segment, &f->segs[s]);
+        }
+    }
+
+    pool_wait(pool);
+    size_t threads = pool_size(pool);
+    pool_destroy(pool);
+    double elapsed = now() - start;
+
+    uint64_t total = 0;
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        file_t *f = &files[i];
+        if (f->error != 0) {
+            fprintf(stderr, "%s: %s\n", f->path, strerror(f->error));
+            if (f->created) {
+                remove(f->outpath);
+            }
+            failed++;
+        } else {
+            double secs = f->end - f->start;
+            total += f->size;
+            if (verbose) {
+                fprintf(stderr, "%s: %" PRIu64 " bytes in %.3f s (%.2f MB/s)\n", f->path,
+                    f->size, secs, secs > 0 ? f->size / secs / 1e6 : 0.0);
+            }
+        }
+        pthread_mutex_destroy(&f->lock);
+        free(f->outpath);
+        free(f->segs);
+    }
+    free(files);
+
+    fprintf(stderr, "batch: %zu files, %" PRIu64 " bytes in %.3f s (%.2f MB/s) on %zu threads",
+        count - failed, total, elapsed, elapsed > 0 ? total / elapsed / 1e6 : 0.0, threads);
+    if (failed > 0) {
+        fprintf(stderr, ", %zu failed", failed);
+    }
+    fprintf(stderr, "\n");
+
+    return failed;
+}
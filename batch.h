@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdio.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// Batch encryption of many files with one public key.
+//
+// Every file is split into segments of whole blocks and all segments of all
+// files are scheduled on one work-stealing pool, so a few huge files keep every
+// core busy while the small ones finish. Each file is encrypted to <file>.enc,
+// with the same contents ss_encrypt_file would produce.
+//
+
+//
+// Collects the files to encrypt from path.
+//
+// Provides:
+//  paths: every regular file below directory path (skipping hidden and .enc
+//         files), or every line of list file path ("-" reads the list from stdin)
+//  count: number of entries in paths
+//
+// Returns false if path can't be read.
+//
+bool batch_collect(const char *path, char ***paths, size_t *count);
+
+//
+// Encrypts count files to <file>.enc.
+//
+// Requires:
+//  paths: files to encrypt
+//  n: public exponent and modulus
+//  nthreads: worker threads (0: one per CPU)
+//  verbose: print a throughput line per file as well as the aggregate summary
+//
+// Returns the number of files that failed.
+//
+size_t batch_encrypt(char *paths[], size_t count, const mpz_t n, size_t nthreads, bool verbose);
@@ -0,0 +1,122 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// header files
+#include "cache.h"
+#include "ckpt.h"
+
+typedef struct {
+    uint64_t hash;
+    uint8_t *data; // key followed by value
+    size_t klen, vlen, cap;
+} slot_t;
+
+struct cache {
+    slot_t *slots;
+    size_t mask;
+    uint64_t lookups, hits;
+};
+
+static _Atomic uint64_t total_lookups, total_hits;
+
+// keys are hashed with the checkpoints' 64-bit FNV-1a
+static uint64_t hash(const uint8_t *key, size_t len) {
+    return ckpt_hash(CKPT_HASH_INIT, key, len);
+}
+
+//
+// Creates a cache of entries slots.
+//
+cache_t *cache_new(size_t entries) {
+    size_t size = 1;
+    while (size < entries) {
+        size <<= 1;
+    }
+
+    cache_t *cache = calloc(1, sizeof(cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->slots = calloc(size, sizeof(slot_t));
+    if (cache->slots == NULL) {
+        free(cache);
+        return NULL;
+    }
+    cache->mask = size - 1;
+    return cache;
+}
+
+//
+// Looks up a key.
+//
+const uint8_t *cache_get(cache_t *cache, const uint8_t *key, size_t klen, size_t *vlen) {
+    uint64_t h = hash(key, klen);
+    slot_t *s = &cache->slots[h & cache->mask];
+
+    cache->lookups++;
+    if (s->data == NULL || s->hash != h || s->klen != klen || memcmp(s->data, key, klen) != 0) {
+        return NULL;
+    }
+    cache->hits++;
+    *vlen = s->vlen;
+    return s->data + klen;
+}
+
+//
+// Stores value for key, replacing the entry in its slot.
+//
+void cache_put(cache_t *cache, const uint8_t *key, size_t klen, const uint8_t *val, size_t vlen) {
+    uint64_t h = hash(key, klen);
+    slot_t *s = &cache->slots[h & cache->mask];
+
+    if (s->cap < klen + vlen) {
+        uint8_t *data = malloc(klen + vlen);
+        if (data == NULL) {
+            return; // the cache is only an optimization
+        }
+        // entries may hold plaintext, so the old one is wiped rather than realloc'd away
+        if (s->data != NULL) {
+            explicit_bzero(s->data, s->cap);
+            free(s->data);
+        }
+        s->data = data;
+        s->cap = klen + vlen;
+    }
+    memcpy(s->data, key, klen);
+    memcpy(s->data + klen, val, vlen);
+    s->hash = h;
+    s->klen = klen;
+    s->vlen = vlen;
+}
+
+//
+// Wipes and frees the cache and adds its lookups and hits to the totals.
+//
+void cache_free(cache_t *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    atomic_fetch_add(&total_lookups, cache->lookups);
+    atomic_fetch_add(&total_hits, cache->hits);
+    for (size_t i = 0; i <= cache->mask; i++) {
+        slot_t *s = &cache->slots[i];
+        if (s->data != NULL) {
+            explicit_bzero(s->data, s->cap);
+            free(s->data);
+        }
+    }
+    free(cache->slots);
+    free(cache);
+}
+
+//
+// Lookups and hits of every cache freed so far.
+//
+void cache_totals(uint64_t *lookups, uint64_t *hits) {
+    *lookups = atomic_load(&total_lookups);
+    *hits = atomic_load(&total_hits);
+}
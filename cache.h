@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Bounded cache of block results, keyed by the block's bytes.
+//
+// SS encryption is deterministic, so a block that was seen before under the
+// same key can reuse its earlier result instead of another exponentiation.
+// The cache has a fixed number of slots picked by a 64-bit hash of the key;
+// a new entry replaces whatever held its slot. Keys are compared in full, so
+// a hash collision is only a miss.
+//
+// A cache belongs to one key and one thread. Lookup counts of every cache are
+// added to process-wide totals when it is freed. A decryption cache holds
+// plaintext, so entries are wiped whenever their memory is released.
+//
+
+// slots per cache
+#define CACHE_ENTRIES 256
+
+typedef struct cache cache_t;
+
+//
+// Creates a cache of entries slots (rounded up to a power of two).
+//
+// Returns NULL if memory could not be allocated.
+//
+cache_t *cache_new(size_t entries);
+
+//
+// Looks up a key.
+//
+// Provides:
+//  vlen: length of the value found
+//
+// Returns the stored value, valid until the next cache_put, or NULL on a miss.
+//
+const uint8_t *cache_get(cache_t *cache, const uint8_t *key, size_t klen, size_t *vlen);
+
+//
+// Stores value for key, replacing the entry in its slot.
+//
+void cache_put(cache_t *cache, const uint8_t *key, size_t klen, const uint8_t *val, size_t vlen);
+
+//
+// Wipes and frees the cache and adds its lookups and hits to the totals.
+//
+void cache_free(cache_t *cache);
+
+//
+// Lookups and hits of every cache freed so far.
+//
+void cache_totals(uint64_t *lookups, uint64_t *hits);
@@ -0,0 +1,101 @@
+#include <gmp.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// header files
+#include "ckpt.h"
+
+// bytes read at a time by ckpt_hash_file
+#define HASH_CHUNK 65536
+
+//
+// Continues a 64-bit FNV-1a hash.
+//
+uint64_t ckpt_hash(uint64_t h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 1099511628211u;
+    }
+    return h;
+}
+
+//
+// Continues the hash over part of a file.
+//
+bool ckpt_hash_file(int fd, uint64_t off, uint64_t len, uint64_t *h) {
+    uint8_t *buf = malloc(HASH_CHUNK);
+    bool ok = buf != NULL;
+    while (ok && len > 0) {
+        ssize_t got = pread(fd, buf, len < HASH_CHUNK ? len : HASH_CHUNK, (off_t) off);
+        ok = got > 0;
+        if (ok) {
+            *h = ckpt_hash(*h, buf, (size_t) got);
+            off += (uint64_t) got;
+            len -= (uint64_t) got;
+        }
+    }
+    free(buf);
+    return ok;
+}
+
+//
+// Fingerprint of a key modulus: 64-bit FNV-1a over its hex digits
+//
+uint64_t ckpt_fingerprint(const mpz_t key) {
+    char *hex = mpz_get_str(NULL, 16, key);
+    uint64_t h = ckpt_hash(CKPT_HASH_INIT, hex, strlen(hex));
+
+    void (*free_func)(void *, size_t);
+    mp_get_memory_functions(NULL, NULL, &free_func);
+    free_func(hex, strlen(hex) + 1);
+    return h;
+}
+
+//
+// Reads a checkpoint.
+//
+bool ckpt_load(const char *path, ckpt_t *ck) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return false;
+    }
+
+    char mode[16] = "";
+    int got = fscanf(f,
+        "ss-ckpt 2\nmode %15s\nkey %" SCNx64 "\nblock %" SCNu64 "\nin %" SCNu64 "\nout %" SCNu64
+        "\ninhash %" SCNx64 "\nouthash %" SCNx64,
+        mode, &ck->key, &ck->block, &ck->in_off, &ck->out_off, &ck->in_hash, &ck->out_hash);
+    fclose(f);
+
+    ck->decrypt = strcmp(mode, "decrypt") == 0;
+    return got == 7 && (ck->decrypt || strcmp(mode, "encrypt") == 0);
+}
+
+//
+// Atomically replaces the checkpoint at path.
+//
+bool ckpt_save(const char *path, const ckpt_t *ck) {
+    char *tmp = malloc(strlen(path) + 5);
+    sprintf(tmp, "%s.tmp", path);
+
+    FILE *f = fopen(tmp, "w");
+    bool ok = f != NULL;
+    if (ok) {
+        fprintf(f,
+            "ss-ckpt 2\nmode %s\nkey %" PRIx64 "\nblock %" PRIu64 "\nin %" PRIu64 "\nout %" PRIu64
+            "\ninhash %" PRIx64 "\nouthash %" PRIx64 "\n",
+            ck->decrypt ? "decrypt" : "encrypt", ck->key, ck->block, ck->in_off, ck->out_off,
+            ck->in_hash, ck->out_hash);
+        ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+        ok = fclose(f) == 0 && ok;
+    }
+    ok = ok && rename(tmp, path) == 0;
+
+    free(tmp);
+    return ok;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdio.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// Checkpoints of a long-running encrypt or decrypt job.
+//
+// A checkpoint records how far the output is known to be complete: the number
+// of blocks fully written and the input and output offsets right after them.
+// It also carries a fingerprint of the key (never the key itself) so a job is
+// not resumed with a different key, a hash of the input consumed so far so a
+// changed input is not spliced onto old output, and a hash of the end of the
+// partial output so a damaged output is not extended.
+//
+
+// seconds between checkpoints
+#define CKPT_SECONDS 10
+
+// output bytes before out_off covered by out_hash
+#define CKPT_TAIL 4096
+
+// starting value of ckpt_hash
+#define CKPT_HASH_INIT 14695981039346656037u
+
+typedef struct {
+    bool decrypt; // job direction
+    uint64_t key; // ckpt_fingerprint of n (encrypt) or pq (decrypt)
+    uint64_t block; // blocks fully written
+    uint64_t in_off; // input offset after those blocks
+    uint64_t out_off; // output offset after those blocks
+    uint64_t in_hash; // ckpt_hash of the input before in_off
+    uint64_t out_hash; // ckpt_hash of the last CKPT_TAIL output bytes before out_off
+} ckpt_t;
+
+//
+// Fingerprint of a key modulus, stored in place of the key.
+//
+uint64_t ckpt_fingerprint(const mpz_t key);
+
+//
+// Continues the 64-bit FNV-1a hash h (CKPT_HASH_INIT to start) over len bytes of data.
+//
+uint64_t ckpt_hash(uint64_t h, const void *data, size_t len);
+
+//
+// Continues the hash h over the len bytes of file fd starting at off.
+//
+// Returns false if they could not all be read.
+//
+bool ckpt_hash_file(int fd, uint64_t off, uint64_t len, uint64_t *h);
+
+//
+// Reads a checkpoint.
+//
+// Returns false if path does not hold a checkpoint.
+//
+bool ckpt_load(const char *path, ckpt_t *ck);
+
+//
+// Atomically replaces the checkpoint at path (write to path.tmp, sync, rename).
+//
+// Returns false if the checkpoint could not be written.
+//
+bool ckpt_save(const char *path, const ckpt_t *ck);
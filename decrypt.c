@@ -1,16 +1,21 @@
 #include <stdio.h>
 #include <gmp.h> // Include the GNU Multiple Precision Arithmetic Library
 #include <unistd.h>
+#include <inttypes.h>
+#include "cache.h"
+#include "modexp.h"
 #include "numtheory.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include "randstate.h"
 #include "ss.h"
+#include "trace.h"
+#include "uring.h"
 #include <time.h>
 #include <sys/stat.h>
 
-#define OPTIONS "i:o:n:hv" // Define the command-line options
+#define OPTIONS "i:o:n:c:m:M:T:rhv" // Define the command-line options
 
 void print_help(void) {
     fprintf(stderr, "SYNOPSIS\n"
@@ -25,7 +30,15 @@ void print_help(void) {
                     "   -v              Display verbose program output.\n"
                     "   -i infile       Input file of data to decrypt (default: stdin).\n"
                     "   -o outfile      Output file for decrypted data (default: stdout).\n"
-                    "   -n pvfile       Private key file (default: ss.priv).\n");
+                    "   -n pvfile       Private key file (default: ss.priv).\n"
+                    "   -c ckptfile     Checkpoint progress to ckptfile (needs -i and -o).\n"
+                    "   -r              Resume the job recorded in the -c checkpoint.\n"
+                    "   -m backend      Modular exponentiation backend (pow_mod, window, gmp,\n"
+                    "                   gmp-sec; default: the fastest, measured per key size).\n"
+                    "   -M tunefile     Cache the measured backends in tunefile and reuse them.\n"
+                    "   -T tracefile    Write a timeline of the block loop (read, import,\n"
+                    "                   exponentiate, export, write) to tracefile as Chrome\n"
+                    "                   trace-event JSON.\n");
     return;
 }
 
@@ -34,7 +47,10 @@ int main(int argc, char **argv) {
     FILE *infile_h = stdin, *outfile_h = stdout,
          *pvfile_h; // Initialize input and output file handlers
     char *infile = NULL, *outfile = NULL, *pvfile = "ss.priv"; // Initialize file names
-    bool verbose = false; // Initialize verbose flag
+    char *ckpt = NULL, *backend = NULL; // Initialize checkpoint file and backend names
+    char *tunefile = NULL; // Initialize backend cache file name
+    char *tracefile = NULL; // Initialize trace file name
+    bool verbose = false, resume = false; // Initialize verbose and resume flags
 
     int opt = 0;
 
@@ -45,23 +61,62 @@ int main(int argc, char **argv) {
         case 'i': infile = optarg; break;
         case 'o': outfile = optarg; break;
         case 'n': pvfile = optarg; break;
+        case 'c': ckpt = optarg; break;
+        case 'm': backend = optarg; break;
+        case 'M': tunefile = optarg; break;
+        case 'T': tracefile = optarg; break;
+        case 'r': resume = true; break;
         case 'v': verbose = true; break;
         case 'h': print_help(); return 0;
         default: print_help(); return 1;
         }
     }
 
+    // Checkpoints need seekable files
+    if ((ckpt != NULL || resume) && (ckpt == NULL || infile == NULL || outfile == NULL)) {
+        fprintf(stderr, "decrypt: -c takes -i and -o; -r needs -c\n");
+        return 1;
+    }
+
+    // A forced backend replaces the per-size calibration
+    if (backend != NULL && !modexp_force(backend)) {
+        fprintf(stderr, "decrypt: unknown backend %s; available:", backend);
+        for (size_t i = 0; i < modexp_count(); i++) {
+            fprintf(stderr, " %s", modexp_get(i)->name);
+        }
+        fprintf(stderr, "\n");
+        return 1;
+    }
+
+    // Start recording spans before any block is decrypted
+    if (tracefile != NULL && !trace_open(TRACE_EVENTS)) {
+        fprintf(stderr, "decrypt: could not allocate the trace buffer\n");
+        return 1;
+    }
+
     // Open the private key file for reading
     pvfile_h = fopen(pvfile, "r");
+    if (pvfile_h == NULL) {
+        perror(pvfile);
+        return 1;
+    }
 
     // If an input file was specified, open it for reading
     if (infile != NULL) {
         infile_h = fopen(infile, "r");
+        if (infile_h == NULL) {
+            perror(infile);
+            return 1;
+        }
     }
 
-    // If an output file was specified, open it for writing
+    // If an output file was specified, open it for writing; resuming keeps the partial output
     if (outfile != NULL) {
-        outfile_h = fopen(outfile, "w");
+        outfile_h = fopen(outfile, resume ? "r+" : "w+");
+        if (outfile_h == NULL) {
+            perror(outfile);
+            return 1;
+        }
     }
 
     // Initialize two big integers
@@ -71,14 +126,62 @@ int main(int argc, char **argv) {
     // Read the private key from the file
     ss_read_priv(pq, d, pvfile_h);
 
+    // Pick the exponentiation backend for this modulus size
+    const modexp_backend_t *b = modexp_tune(mpz_sizeinbase(pq, 2), tunefile);
+
     // If the verbose flag is set, print the values of pq and d
     if (verbose) {
         gmp_fprintf(stderr, "pq (%lu bits) = %Zu\n", mpz_sizeinbase(pq, 2), pq);
         gmp_fprintf(stderr, "d  (%lu bits) = %Zu\n", mpz_sizeinbase(d, 2), d);
+        fprintf(stderr, "modexp: %s\n", b->name);
+    }
+
+    // Compressed ciphertext is only understood by ss_decrypt_file
+    int first = getc(infile_h);
+    ungetc(first, infile_h);
+    bool compressed = first == SS_LZ_HEADER[0];
+    if (compressed && ckpt != NULL) {
+        fprintf(stderr, "decrypt: -c does not support compressed ciphertext\n");
+        return 1;
+    }
+
+    // Regular files go through io_uring when the kernel offers it; tracing follows the stdio loop
+    uring_t *ring = NULL;
+    if (!compressed && ckpt == NULL && tracefile == NULL && infile != NULL && outfile != NULL
+        && uring_supports(fileno(infile_h)) && uring_supports(fileno(outfile_h))) {
+        ring = uring_open();
     }
 
     // Decrypt the input file using the private key and write the result to the output file
-    ss_decrypt_file(infile_h, outfile_h, d, pq);
+    if (ring != NULL) {
+        if (verbose) {
+            fprintf(stderr, "io: io_uring\n");
+        }
+        if (!uring_decrypt_file(ring, fileno(infile_h), fileno(outfile_h), d, pq)) {
+            perror("decrypt");
+            exit(1);
+        }
+        uring_close(ring);
+    } else if (ckpt != NULL) {
+        if (!ss_decrypt_file_ckpt(infile_h, outfile_h, d, pq, ckpt, resume)) {
+            return 1;
+        }
+    } else if (!ss_decrypt_file(infile_h, outfile_h, d, pq)) {
+        return 1;
+    }
+
+    // Write the recorded spans
+    if (tracefile != NULL && !trace_close(tracefile)) {
+        perror(tracefile);
+    }
+
+    // Report how many blocks the block caches saved an exponentiation for
+    uint64_t lookups, hits;
+    cache_totals(&lookups, &hits);
+    if (verbose && lookups > 0) {
+        fprintf(stderr, "cache: %" PRIu64 " of %" PRIu64 " blocks reused (%.1f%%)\n", hits,
+            lookups, 100.0 * hits / lookups);
+    }
 
     // Close all open file handlers and clear the big integers
     fclose(pvfile_h);
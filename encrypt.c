@@ -1,17 +1,33 @@
 
 #include <stdio.h>
 #include <gmp.h>
+#include <getopt.h>
+#include <inttypes.h>
 #include <unistd.h>
+#include "batch.h"
+#include "cache.h"
+#include "modexp.h"
 #include "numtheory.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include "randstate.h"
+#include "shard.h"
 #include "ss.h"
+#include "trace.h"
+#include "uring.h"
+#include <string.h>
 #include <time.h>
 #include <sys/stat.h>
 
-#define OPTIONS "i:o:n:hv"
+#define OPTIONS "i:o:n:t:c:m:M:T:rzhv"
+
+static const struct option long_options[] = {
+    { "batch", required_argument, NULL, 'B' },
+    { "shards", required_argument, NULL, 'S' },
+    { "range", required_argument, NULL, 'R' },
+    { NULL, 0, NULL, 0 },
+};
 
 void print_help(void) {
     fprintf(stderr, "SYNOPSIS\n"
@@ -20,27 +36,73 @@ void print_help(void) {
                     "\n"
                     "USAGE\n"
                     "   ./encrypt [OPTIONS]\n"
+                    "   ./encrypt [OPTIONS] --batch dir|listfile\n"
+                    "   ./encrypt [OPTIONS] --shards count -i infile -o outfile\n"
                     "\n"
                     "OPTIONS\n"
                     "   -h              Display program help and usage.\n"
                     "   -v              Display verbose program output.\n"
                     "   -i infile       Input file of data to encrypt (default: stdin).\n"
                     "   -o outfile      Output file for encrypted data (default: stdout).\n"
-                    "   -n pbfile       Public key file (default: ss.pub).\n");
+                    "   -n pbfile       Public key file (default: ss.pub). Repeat to encrypt\n"
+                    "                   for several recipients; each ciphertext is then written\n"
+                    "                   to outfile.<key name>.\n"
+                    "   -z              Compress the data before encrypting it.\n"
+                    "   -c ckptfile     Checkpoint progress to ckptfile (needs -i and -o).\n"
+                    "   -r              Resume the job recorded in the -c checkpoint.\n"
+                    "   -m backend      Modular exponentiation backend (pow_mod, window, gmp,\n"
+                    "                   gmp-sec; default: the fastest, measured per key size).\n"
+                    "   -M tunefile     Cache the measured backends in tunefile and reuse them.\n"
+                    "   -T tracefile    Write a timeline of the block loop (read, import,\n"
+                    "                   exponentiate, export, write) to tracefile as Chrome\n"
+                    "                   trace-event JSON.\n"
+                    "   -t threads      Worker threads for several recipients or --batch\n"
+                    "                   (default: one per CPU).\n"
+                    "   --batch path    Encrypt every file below directory path, or every file\n"
+                    "                   listed in path (one per line, - for stdin), to <file>.enc.\n"
+                    "   --shards count  Split infile into count shards on block boundaries,\n"
+                    "                   encrypt them in separate processes (at most -t at once)\n"
+                    "                   and merge the results into outfile (0: one per CPU).\n"
+                    "   --range off:len Encrypt len bytes of infile from byte off, a multiple of\n"
+                    "                   the block size (used by --shards).\n");
     return;
 }
 
+//
+// Builds the output path for one recipient: outfile.<key file name without .pub>
+//
+static char *recipient_path(const char *outfile, const char *pbfile) {
+    const char *name = strrchr(pbfile, '/');
+    name = name ? name + 1 : pbfile;
+
+    size_t len = strlen(name);
+    if (len > 4 && strcmp(name + len - 4, ".pub") == 0) {
+        len -= 4;
+    }
+
+    char *path = malloc(strlen(outfile) + len + 2);
+    if (path != NULL) {
+        sprintf(path, "%s.%.*s", outfile, (int) len, name);
+    }
+    return path;
+}
+
 int main(int argc, char **argv) {
 
     // Set default values for input and output files
     FILE *infile_h = stdin, *outfile_h = stdout, *pvfile_h;
-    char *infile = NULL, *outfile = NULL, *pvfile = "ss.pub";
-    bool verbose = false;
+    char *infile = NULL, *outfile = NULL, *batch = NULL, *ckpt = NULL, *backend = NULL;
+    char *tunefile = NULL;
+    char *tracefile = NULL;
+    char **pbfiles = NULL;
+    size_t count = 0, nthreads = 0, shards = 0;
+    uint64_t range_off = 0, range_len = 0;
+    bool verbose = false, compress = false, resume = false, sharded = false, ranged = false;
 
     int opt = 0;
 
     // Parse command line arguments
-    while ((opt = getopt(argc, argv, "i:o:n:hv")) != -1) {
+    while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
 
         switch (opt) {
         case 'i':
@@ -51,9 +113,61 @@ int main(int argc, char **argv) {
             // Open output file and set outfile variable
             outfile = optarg;
             break;
-        case 'n':
-            // Set public key file
-            pvfile = optarg;
+        case 'n': {
+            // Add a public key file
+            char **grown = realloc(pbfiles, (count + 1) * sizeof(char *));
+            if (grown == NULL) {
+                fprintf(stderr, "encrypt: out of memory\n");
+                return 1;
+            }
+            pbfiles = grown;
+            pbfiles[count++] = optarg;
+            break;
+        }
+        case 'B':
+            // Encrypt a directory or list of files
+            batch = optarg;
+            break;
+        case 'S':
+            // Encrypt in shards run by worker processes
+            sharded = true;
+            shards = (size_t) strtoul(optarg, NULL, 10);
+            break;
+        case 'R':
+            // Encrypt one shard
+            ranged = true;
+            if (sscanf(optarg, "%" SCNu64 ":%" SCNu64, &range_off, &range_len) != 2) {
+                fprintf(stderr, "encrypt: --range takes offset:length\n");
+                return 1;
+            }
+            break;
+        case 't':
+            // Set worker thread count
+            nthreads = (size_t) strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            // Set checkpoint file
+            ckpt = optarg;
+            break;
+        case 'm':
+            // Force a modular exponentiation backend
+            backend = optarg;
+            break;
+        case 'M':
+            // Cache the tuned backends
+            tunefile = optarg;
+            break;
+        case 'T':
+            // Trace the block loop
+            tracefile = optarg;
+            break;
+        case 'r':
+            // Resume from the checkpoint
+            resume = true;
+            break;
+        case 'z':
+            // Compress before encrypting
+            compress = true;
             break;
         case 'v':
             // Set verbose flag
@@ -70,8 +184,96 @@ int main(int argc, char **argv) {
         }
     }
 
-    // Open public key file
-    pvfile_h = fopen(pvfile, "r");
+    if (backend != NULL && !modexp_force(backend)) {
+        fprintf(stderr, "encrypt: unknown backend %s; available:", backend);
+        for (size_t i = 0; i < modexp_count(); i++) {
+            fprintf(stderr, " %s", modexp_get(i)->name);
+        }
+        fprintf(stderr, "\n");
+        return 1;
+    }
+
+    if (tracefile != NULL && !trace_open(TRACE_EVENTS)) {
+        fprintf(stderr, "encrypt: could not allocate the trace buffer\n");
+        return 1;
+    }
+
+    if (count == 0) {
+        pbfiles = malloc(sizeof(char *));
+        pbfiles[count++] = "ss.pub";
+    }
+
+    // Batch mode names its own inputs and outputs
+    if (batch != NULL && (count > 1 || infile != NULL || outfile != NULL)) {
+        fprintf(stderr, "encrypt: --batch takes one -n and no -i or -o\n");
+        return 1;
+    }
+
+    // Compression is only wired into the single-file path
+    if (compress && (batch != NULL || count > 1)) {
+        fprintf(stderr, "encrypt: -z takes one -n and no --batch\n");
+        return 1;
+    }
+
+    // Checkpoints need seekable files and the plain block loop
+    if ((ckpt != NULL || resume)
+        && (ckpt == NULL || infile == NULL || outfile == NULL || count > 1 || compress
+            || batch != NULL)) {
+        fprintf(stderr, "encrypt: -c takes -i and -o, one -n, and no -z or --batch; -r needs -c\n");
+        return 1;
+    }
+
+    // Shards are byte ranges of one seekable file, encrypted by the plain block loop
+    if ((sharded || ranged)
+        && (sharded == ranged || infile == NULL || (sharded && outfile == NULL) || count > 1
+            || compress || ckpt != NULL || batch != NULL || (sharded && tracefile != NULL))) {
+        fprintf(stderr, "encrypt: --shards and --range take -i (and --shards -o), one -n, and no\n"
+                        "         -z, -c, --batch or each other; --shards takes no -T\n");
+        return 1;
+    }
+
+    // Several ciphertexts can't share stdout
+    if (count > 1 && outfile == NULL) {
+        fprintf(stderr, "encrypt: several recipients need -o outfile\n");
+        return 1;
+    }
+
+    if (batch != NULL) {
+        char **paths;
+        size_t npaths;
+        if (!batch_collect(batch, &paths, &npaths)) {
+            perror(batch);
+            return 1;
+        }
+
+        mpz_t n;
+        mpz_init(n);
+        char username[SS_USERNAME_MAX + 1];
+        pvfile_h = fopen(pbfiles[0], "r");
+        if (pvfile_h == NULL) {
+            perror(pbfiles[0]);
+            return 1;
+        }
+        ss_read_pub(n, username, pvfile_h);
+        fclose(pvfile_h);
+        const modexp_backend_t *b = modexp_tune(mpz_sizeinbase(n, 2), tunefile);
+
+        if (verbose) {
+            gmp_fprintf(stderr, "user: %s\n", username);
+            gmp_fprintf(stderr, "n (%zu bits) = %Zu\n", mpz_sizeinbase(n, 2), n);
+            fprintf(stderr, "modexp: %s\n", b->name);
+        }
+
+        size_t failed = batch_encrypt(paths, npaths, n, nthreads, verbose);
+
+        for (size_t i = 0; i < npaths; i++) {
+            free(paths[i]);
+        }
+        free(paths);
+        free(pbfiles);
+        mpz_clear(n);
+        return failed > 0 ? 1 : 0;
+    }
 
     // If an input file was specified, open it and set infile_h to point to it
     if (infile != NULL) {
@@ -80,34 +282,175 @@ int main(int argc, char **argv) {
 
     // If the input file does not exist, print an error message and exit
     if (infile_h == NULL) {
-        printf("%s: No such file or directory\n", infile);
-        exit(0);
+        perror(infile);
+        exit(1);
+    }
+
+    // Initialize a GMP integer per recipient and read the public keys from the files
+    mpz_t *ns = calloc(count, sizeof(mpz_t));
+    FILE **outfiles_h = calloc(count, sizeof(FILE *));
+    char username[SS_USERNAME_MAX + 1];
+    if (ns == NULL || outfiles_h == NULL) {
+        fprintf(stderr, "encrypt: out of memory\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        // Open public key file
+        pvfile_h = fopen(pbfiles[i], "r");
+        if (pvfile_h == NULL) {
+            perror(pbfiles[i]);
+            exit(1);
+        }
+
+        mpz_init(ns[i]);
+        ss_read_pub(ns[i], username, pvfile_h);
+        fclose(pvfile_h);
+
+        // Pick the exponentiation backend for this key size before any worker starts
+        const modexp_backend_t *b = modexp_tune(mpz_sizeinbase(ns[i], 2), tunefile);
+
+        // If the verbose flag is set, print some information about the public key
+        if (verbose) {
+            gmp_fprintf(stderr, "user: %s\n", username);
+            gmp_fprintf(stderr, "n (%zu bits) = %Zu\n", mpz_sizeinbase(ns[i], 2), ns[i]);
+            fprintf(stderr, "modexp: %s\n", b->name);
+        }
+
+        // A single recipient writes to outfile itself, several to outfile.<key name>
+        if (count == 1) {
+            // Resuming keeps the partial output
+            outfiles_h[i] = outfile != NULL ? fopen(outfile, resume ? "r+" : "w+") : outfile_h;
+            if (outfiles_h[i] == NULL) {
+                perror(outfile);
+                exit(1);
+            }
+        } else {
+            char *path = recipient_path(outfile, pbfiles[i]);
+            if (path == NULL) {
+                fprintf(stderr, "encrypt: out of memory\n");
+                exit(1);
+            }
+            for (size_t j = 0; j < i; j++) {
+                char *other = recipient_path(outfile, pbfiles[j]);
+                bool clash = other == NULL || strcmp(path, other) == 0;
+                if (other == NULL) {
+                    fprintf(stderr, "encrypt: out of memory\n");
+                } else if (clash) {
+                    fprintf(stderr, "encrypt: %s and %s both write %s\n", pbfiles[j], pbfiles[i],
+                        path);
+                }
+                free(other);
+                if (clash) {
+                    free(path);
+                    exit(1);
+                }
+            }
+            outfiles_h[i] = fopen(path, "w");
+            if (outfiles_h[i] == NULL) {
+                perror(path);
+                free(path);
+                exit(1);
+            }
+            free(path);
+        }
     }
 
-    // If an output file was specified, open it and set outfile_h to point to it
-    if (outfile != NULL) {
-        outfile_h = fopen(outfile, "w");
+    // Regular files go through io_uring when the kernel offers it; tracing follows the stdio loop
+    uring_t *ring = NULL;
+    if (count == 1 && !compress && ckpt == NULL && tracefile == NULL && !sharded && !ranged
+        && infile != NULL && outfile != NULL && uring_supports(fileno(infile_h))
+        && uring_supports(fileno(outfiles_h[0]))) {
+        ring = uring_open();
     }
 
-    // Initialize a GMP integer and read the public key from the file
-    mpz_t n;
-    mpz_inits(n, NULL);
-    char *username = getenv("USER");
-    ss_read_pub(n, username, pvfile_h);
+    if (sharded) {
+        // workers are this same program, run with --range
+        char exe[4096];
+        ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        if (len > 0) {
+            exe[len] = '\0';
+        } else {
+            snprintf(exe, sizeof(exe), "%s", argv[0]);
+        }
+
+        shard_transport_t *local = shard_local(exe, infile, pbfiles[0], modexp_backend(ns[0])->name);
+        bool ok = local != NULL
+            && shard_encrypt(infile, outfile, ns[0], shards, nthreads, local, verbose);
+        if (local != NULL) {
+            local->close(local);
+        }
+        if (!ok) {
+            exit(1);
+        }
+    } else if (ranged) {
+        // only block-aligned ranges line up with the blocks of a whole-file run
+        if (range_off % (ss_block_size(ns[0]) - 1) != 0) {
+            fprintf(stderr, "encrypt: --range offset %" PRIu64 " is not on a block boundary\n",
+                range_off);
+            exit(1);
+        }
+        if (fseeko(infile_h, (off_t) range_off, SEEK_SET) != 0) {
+            perror(infile);
+            exit(1);
+        }
+        if (!ss_encrypt_file_range(infile_h, outfiles_h[0], ns[0], range_len)) {
+            fprintf(stderr, "encrypt: could not write the ciphertext\n");
+            exit(1);
+        }
+    } else if (ring != NULL) {
+        if (verbose) {
+            fprintf(stderr, "io: io_uring\n");
+        }
+        if (!uring_encrypt_file(ring, fileno(infile_h), fileno(outfiles_h[0]), ns[0])) {
+            perror("encrypt");
+            exit(1);
+        }
+        uring_close(ring);
+    } else if (ckpt != NULL) {
+        if (!ss_encrypt_file_ckpt(infile_h, outfiles_h[0], ns[0], ckpt, resume)) {
+            exit(1);
+        }
+    } else if (count == 1 && compress) {
+        if (!ss_encrypt_file_lz(infile_h, outfiles_h[0], ns[0])) {
+            fprintf(stderr, "encrypt: out of memory\n");
+            exit(1);
+        }
+    } else if (count == 1) {
+        if (!ss_encrypt_file(infile_h, outfiles_h[0], ns[0])) {
+            fprintf(stderr, "encrypt: could not write the ciphertext\n");
+            exit(1);
+        }
+    } else if (!ss_encrypt_file_multi(infile_h, outfiles_h, ns, count, nthreads)) {
+        fprintf(stderr, "encrypt: could not write the ciphertext for every recipient\n");
+        exit(1);
+    }
 
-    // If the verbose flag is set, print some information about the public key
-    if (verbose) {
-        gmp_fprintf(stderr, "user: %s\n", username);
-        gmp_fprintf(stderr, "n (%zu bits) = %Zu\n", mpz_sizeinbase(n, 2), n);
+    if (tracefile != NULL && !trace_close(tracefile)) {
+        perror(tracefile);
     }
 
-    ss_encrypt_file(infile_h, outfile_h, n);
+    // Report how many blocks the block caches saved an exponentiation for
+    uint64_t lookups, hits;
+    cache_totals(&lookups, &hits);
+    if (verbose && lookups > 0) {
+        fprintf(stderr, "cache: %" PRIu64 " of %" PRIu64 " blocks reused (%.1f%%)\n", hits,
+            lookups, 100.0 * hits / lookups);
+    }
 
-    // clear and return
-    fclose(pvfile_h);
+    // clear and return; output still buffered must reach the files too
+    int status = 0;
     fclose(infile_h);
-    fclose(outfile_h);
-    mpz_clears(n, NULL);
+    for (size_t i = 0; i < count; i++) {
+        if (fclose(outfiles_h[i]) != 0) {
+            perror("encrypt");
+            status = 1;
+        }
+        mpz_clear(ns[i]);
+    }
+    free(outfiles_h);
+    free(ns);
+    free(pbfiles);
 
-    return 0;
+    return status;
 }
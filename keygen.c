@@ -13,8 +13,9 @@
 #include "numtheory.h"
 #include "randstate.h"
 #include "ss.h"
+#include "trace.h"
 
-#define OPTIONS "b:i:n:d:s:vh"
+#define OPTIONS "b:i:n:d:s:t:LT:vh"
 
 void print_help(void) {
     fprintf(stderr, "SYNOPSIS\n"
@@ -30,7 +31,12 @@ void print_help(void) {
                     "   -i iterations   Miller-Rabin iterations for testing primes (default: 50).\n"
                     "   -n pbfile       Public key file (default: ss.pub).\n"
                     "   -d pvfile       Private key file (default: ss.priv).\n"
-                    "   -s seed         Random seed for testing.\n");
+                    "   -s seed         Random seed for testing.\n"
+                    "   -t threads      Threads testing prime candidates (default: one per CPU).\n"
+                    "   -L              Share each candidate's Miller-Rabin rounds among the\n"
+                    "                   threads, for lower latency per prime.\n"
+                    "   -T tracefile    Write a timeline of the prime search (one span per\n"
+                    "                   candidate test) to tracefile as Chrome trace-event JSON.\n");
     return;
 }
 
@@ -40,12 +46,13 @@ int main(int argc, char **argv) {
     uint64_t iters = 50; // default iterations
     FILE *pbfile_h, *pvfile_h;
 
-    char *pbfile = "ss.pub", *pvfile = "ss.priv";
+    char *pbfile = "ss.pub", *pvfile = "ss.priv", *tracefile = NULL;
     uint64_t seed = time(NULL);
-    bool verbose = false;
+    bool verbose = false, split = false;
+    size_t threads = 0;
 
     int opt = 0;
-    while ((opt = getopt(argc, argv, "b:i:n:d:s:vh")) != -1) {
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
         switch (opt) {
         case 'h':
             print_help();
@@ -56,6 +63,9 @@ int main(int argc, char **argv) {
         case 'i': iters = (uint64_t) strtoul(optarg, NULL, 10); break;
         case 'n': pbfile = optarg; break;
         case 'd': pvfile = optarg; break;
+        case 'T': tracefile = optarg; break;
+        case 't': threads = (size_t) strtoul(optarg, NULL, 10); break;
+        case 'L': split = true; break;
         case 's':
             seed = (uint64_t) strtoul(optarg, NULL, 10);
             break;
@@ -96,13 +106,22 @@ int main(int argc, char **argv) {
 
     randstate_init(seed);
 
+    if (tracefile != NULL && !trace_open(TRACE_EVENTS)) {
+        fprintf(stderr, "keygen: could not allocate the trace buffer\n");
+        return 1;
+    }
+
     // initialize  variables for makepub and makepriv
     mpz_t p, q, n, pq, d, s;
     mpz_inits(p, q, n, pq, d, s, NULL);
 
-    ss_make_pub(p, q, n, nbits, iters); // make public key
+    ss_make_pub_r(p, q, n, nbits, iters, state, threads, split); // make public key
     ss_make_priv(d, pq, p, q); //  m ake private key
 
+    if (tracefile != NULL && !trace_close(tracefile)) {
+        perror(tracefile);
+    }
+
     // write to the files
     ss_write_pub(n, username, pbfile_h); // write keys to their files
     ss_write_priv(pq, d, pvfile_h); // write keys to their files
@@ -0,0 +1,265 @@
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// header files
+#include "libss.h"
+#include "modexp.h"
+#include "ss.h"
+
+struct ss_rng {
+    gmp_randstate_t state;
+    size_t nthreads; // prime search threads for ss_keygen, see ss_rng_threads
+    bool split;
+};
+
+struct ss_pub {
+    mpz_t n;
+    char username[SS_USERNAME_MAX + 1];
+};
+
+struct ss_priv {
+    mpz_t pq;
+    mpz_t d;
+};
+
+static ss_pub_t *pub_new(void) {
+    ss_pub_t *pub = calloc(1, sizeof(ss_pub_t));
+    if (pub != NULL) {
+        mpz_init(pub->n);
+    }
+    return pub;
+}
+
+static ss_priv_t *priv_new(void) {
+    ss_priv_t *priv = calloc(1, sizeof(ss_priv_t));
+    if (priv != NULL) {
+        mpz_inits(priv->pq, priv->d, NULL);
+    }
+    return priv;
+}
+
+//
+// Creates a random state seeded with seed.
+//
+ss_rng_t *ss_rng_new(uint64_t seed) {
+    ss_rng_t *rng = malloc(sizeof(ss_rng_t));
+    if (rng == NULL) {
+        return NULL;
+    }
+    gmp_randinit_mt(rng->state);
+    gmp_randseed_ui(rng->state, seed);
+    rng->nthreads = 1;
+    rng->split = false;
+    return rng;
+}
+
+//
+// Sets the threads ss_keygen with this random state searches primes on.
+//
+void ss_rng_threads(ss_rng_t *rng, size_t nthreads, bool split) {
+    rng->nthreads = nthreads;
+    rng->split = split;
+}
+
+//
+// Frees a random state created by ss_rng_new.
+//
+void ss_rng_free(ss_rng_t *rng) {
+    if (rng != NULL) {
+        gmp_randclear(rng->state);
+        free(rng);
+    }
+}
+
+//
+// Generates a new SS key pair.
+//
+bool ss_keygen(ss_pub_t **pub, ss_priv_t **priv, uint64_t nbits, uint64_t iters,
+    const char *username, ss_rng_t *rng) {
+    // p gets [nbits/5, 2*nbits/5) bits, which needs a non-empty range
+    if (nbits < 16) {
+        return false;
+    }
+
+    ss_pub_t *new_pub = pub_new();
+    ss_priv_t *new_priv = priv_new();
+    if (new_pub == NULL || new_priv == NULL) {
+        ss_pub_free(new_pub);
+        ss_priv_free(new_priv);
+        return false;
+    }
+
+    mpz_t p, q;
+    mpz_inits(p, q, NULL);
+
+    ss_make_pub_r(p, q, new_pub->n, nbits, iters, rng->state, rng->nthreads, rng->split);
+    ss_make_priv(new_priv->d, new_priv->pq, p, q);
+
+    // the key file stores the name as one whitespace-delimited word
+    if (username == NULL || username[0] == '\0') {
+        username = "unknown";
+    }
+    snprintf(new_pub->username, sizeof(new_pub->username), "%s", username);
+
+    mpz_clears(p, q, NULL);
+
+    *pub = new_pub;
+    *priv = new_priv;
+    return true;
+}
+
+//
+// Imports an SS public key from an input stream.
+//
+ss_pub_t *ss_pub_read(FILE *pbfile) {
+    ss_pub_t *pub = pub_new();
+    if (pub == NULL) {
+        return NULL;
+    }
+
+    // same layout as ss_read_pub, but a missing field is an error; width is SS_USERNAME_MAX
+    if (gmp_fscanf(pbfile, "%Zx\n%256s\n", pub->n, pub->username) != 2
+        || mpz_sgn(pub->n) <= 0) {
+        ss_pub_free(pub);
+        return NULL;
+    }
+    return pub;
+}
+
+//
+// Exports an SS public key to an output stream.
+//
+bool ss_pub_write(const ss_pub_t *pub, FILE *pbfile) {
+    ss_write_pub(pub->n, pub->username, pbfile);
+    return !ferror(pbfile);
+}
+
+void ss_pub_get_n(mpz_t n, const ss_pub_t *pub) {
+    mpz_set(n, pub->n);
+}
+
+size_t ss_pub_bits(const ss_pub_t *pub) {
+    return mpz_sizeinbase(pub->n, 2);
+}
+
+const char *ss_pub_username(const ss_pub_t *pub) {
+    return pub->username;
+}
+
+//
+// Frees a public key handle.
+//
+void ss_pub_free(ss_pub_t *pub) {
+    if (pub != NULL) {
+        mpz_clear(pub->n);
+        free(pub);
+    }
+}
+
+//
+// Imports an SS private key from an input stream.
+//
+ss_priv_t *ss_priv_read(FILE *pvfile) {
+    ss_priv_t *priv = priv_new();
+    if (priv == NULL) {
+        return NULL;
+    }
+
+    if (gmp_fscanf(pvfile, "%Zx\n%Zx\n", priv->pq, priv->d) != 2 || mpz_sgn(priv->pq) <= 0) {
+        ss_priv_free(priv);
+        return NULL;
+    }
+    return priv;
+}
+
+//
+// Exports an SS private key to an output stream.
+//
+bool ss_priv_write(const ss_priv_t *priv, FILE *pvfile) {
+    ss_write_priv(priv->pq, priv->d, pvfile);
+    return !ferror(pvfile);
+}
+
+size_t ss_priv_bits(const ss_priv_t *priv) {
+    return mpz_sizeinbase(priv->pq, 2);
+}
+
+//
+// Zeroes the limbs of a private integer before it is cleared
+//
+static void wipe(mpz_t x) {
+    size_t size = mpz_size(x);
+    if (size > 0) {
+        explicit_bzero(mpz_limbs_modify(x, (mp_size_t) size), size * sizeof(mp_limb_t));
+    }
+}
+
+//
+// Frees a private key handle.
+//
+void ss_priv_free(ss_priv_t *priv) {
+    if (priv != NULL) {
+        wipe(priv->pq);
+        wipe(priv->d);
+        mpz_clears(priv->pq, priv->d, NULL);
+        free(priv);
+    }
+}
+
+//
+// Encrypts an arbitrary file with a public key.
+//
+bool ss_pub_encrypt_file(const ss_pub_t *pub, FILE *infile, FILE *outfile) {
+    return ss_encrypt_file(infile, outfile, pub->n);
+}
+
+//
+// Decrypts a file produced by ss_pub_encrypt_file with the matching private key.
+//
+bool ss_priv_decrypt_file(const ss_priv_t *priv, FILE *infile, FILE *outfile) {
+    return ss_decrypt_file(infile, outfile, priv->d, priv->pq);
+}
+
+size_t ss_pub_encrypt_size(const ss_pub_t *pub, size_t inlen) {
+    return ss_encrypt_buffer_size(inlen, pub->n);
+}
+
+size_t ss_priv_decrypt_size(const ss_priv_t *priv, const uint8_t *in, size_t inlen) {
+    return ss_decrypt_buffer_size(in, inlen, priv->pq);
+}
+
+//
+// Encrypts caller-owned memory with a public key.
+//
+bool ss_pub_encrypt_buffer(const ss_pub_t *pub, uint8_t *out, size_t outcap, size_t *outlen,
+    const uint8_t *in, size_t inlen) {
+    return ss_encrypt_buffer(out, outcap, outlen, in, inlen, pub->n);
+}
+
+//
+// Decrypts caller-owned memory with a private key.
+//
+bool ss_priv_decrypt_buffer(const ss_priv_t *priv, uint8_t *out, size_t outcap, size_t *outlen,
+    const uint8_t *in, size_t inlen) {
+    return ss_decrypt_buffer(out, outcap, outlen, in, inlen, priv->d, priv->pq);
+}
+
+ss_encryptor_t *ss_pub_encryptor(const ss_pub_t *pub, ss_emit_t *emit, void *arg) {
+    return ss_encryptor_init(pub->n, emit, arg);
+}
+
+ss_decryptor_t *ss_priv_decryptor(const ss_priv_t *priv, ss_emit_t *emit, void *arg) {
+    return ss_decryptor_init(priv->d, priv->pq, emit, arg);
+}
+
+bool ss_backend_force(const char *name) {
+    return modexp_force(name);
+}
+
+const char *ss_backend_tune(size_t nbits, const char *tune_file) {
+    return modexp_tune(nbits, tune_file)->name;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <stdio.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stream.h"
+
+//
+// Reentrant, handle-based interface to the SS library (libss.a / libss.so).
+//
+// Keys and random states are opaque handles. Concurrent calls are safe as long
+// as each thread uses its own ss_rng_t; key handles are read-only once created
+// and may be shared between threads.
+//
+// The library does keep a little process-wide state, none of which changes
+// what a call computes: the modular exponentiation backends and the choices
+// made by ss_backend_force and ss_backend_tune, the span ring while a program
+// traces, and the block cache lookup totals. All of it is thread-safe. The
+// global random state used by the non-reentrant internals is never touched by
+// this interface.
+//
+// Only the functions declared here and in stream.h are exported; the
+// library's internals are hidden, so they can't clash with a program's symbols.
+//
+
+typedef struct ss_rng ss_rng_t;
+typedef struct ss_pub ss_pub_t;
+typedef struct ss_priv ss_priv_t;
+
+//
+// Creates a random state seeded with seed.
+//
+// Returns NULL if memory could not be allocated.
+//
+SS_API ss_rng_t *ss_rng_new(uint64_t seed);
+
+//
+// Frees a random state created by ss_rng_new.
+//
+SS_API void ss_rng_free(ss_rng_t *rng);
+
+//
+// Sets how ss_keygen with this random state searches for primes: on nthreads
+// threads (0: one per CPU), sharing each candidate's Miller-Rabin rounds among
+// them if split is set. The generated keys are the same either way; by
+// default the search runs on the calling thread only.
+//
+SS_API void ss_rng_threads(ss_rng_t *rng, size_t nthreads, bool split);
+
+//
+// Generates a new SS key pair.
+//
+// Provides:
+//  pub: new public key handle, owned by the caller
+//  priv: new private key handle, owned by the caller
+//
+// Requires:
+//  nbits: minimum # of bits in n (at least 16)
+//  iters: iterations of Miller-Rabin to use for primality check
+//  username: login name of the keyholder stored in the public key
+//  rng: random state, not used by any other thread during the call
+//
+// Returns false if nbits is too small or memory could not be allocated.
+//
+SS_API bool ss_keygen(ss_pub_t **pub, ss_priv_t **priv, uint64_t nbits, uint64_t iters,
+    const char *username, ss_rng_t *rng);
+
+//
+// Imports an SS public key from an input stream.
+//
+// Returns NULL if pbfile does not hold a public key.
+//
+SS_API ss_pub_t *ss_pub_read(FILE *pbfile);
+
+//
+// Exports an SS public key to an output stream.
+//
+// Returns false if the key could not be written.
+//
+SS_API bool ss_pub_write(const ss_pub_t *pub, FILE *pbfile);
+
+//
+// Accessors for the public modulus, its size and the keyholder name.
+//
+SS_API void ss_pub_get_n(mpz_t n, const ss_pub_t *pub);
+SS_API size_t ss_pub_bits(const ss_pub_t *pub);
+SS_API const char *ss_pub_username(const ss_pub_t *pub);
+
+//
+// Frees a public key handle.
+//
+SS_API void ss_pub_free(ss_pub_t *pub);
+
+//
+// Imports an SS private key from an input stream.
+//
+// Returns NULL if pvfile does not hold a private key.
+//
+SS_API ss_priv_t *ss_priv_read(FILE *pvfile);
+
+//
+// Exports an SS private key to an output stream.
+//
+// Returns false if the key could not be written.
+//
+SS_API bool ss_priv_write(const ss_priv_t *priv, FILE *pvfile);
+
+//
+// Accessor for the size of the private modulus.
+//
+SS_API size_t ss_priv_bits(const ss_priv_t *priv);
+
+//
+// Frees a private key handle.
+//
+SS_API void ss_priv_free(ss_priv_t *priv);
+
+//
+// Encrypts an arbitrary file with a public key.
+//
+// Provides:
+//  fills outfile with the encrypted contents of infile
+//
+// Returns false if memory could not be allocated or outfile could not be written.
+//
+SS_API bool ss_pub_encrypt_file(const ss_pub_t *pub, FILE *infile, FILE *outfile);
+
+//
+// Decrypts a file produced by ss_pub_encrypt_file with the matching private key.
+// Compressed ciphertext written by encrypt -z is decompressed as well.
+//
+// Provides:
+//  fills outfile with the unencrypted data from infile
+//
+// Returns false if infile is not ciphertext, starts with an unknown header or
+// has corrupt compressed frames, or if outfile could not be written.
+//
+SS_API bool ss_priv_decrypt_file(const ss_priv_t *priv, FILE *infile, FILE *outfile);
+
+//
+// Buffer sizes that always suffice for ss_pub_encrypt_buffer / ss_priv_decrypt_buffer.
+//
+SS_API size_t ss_pub_encrypt_size(const ss_pub_t *pub, size_t inlen);
+SS_API size_t ss_priv_decrypt_size(
+    const ss_priv_t *priv, const uint8_t *in, size_t inlen);
+
+//
+// Encrypts / decrypts caller-owned memory, see ss_encrypt_buffer and ss_decrypt_buffer.
+//
+// Returns false if out is too small (or, when decrypting, in is not ciphertext;
+// compressed ciphertext from encrypt -z counts as not ciphertext here).
+//
+SS_API bool ss_pub_encrypt_buffer(const ss_pub_t *pub, uint8_t *out, size_t outcap,
+    size_t *outlen, const uint8_t *in, size_t inlen);
+SS_API bool ss_priv_decrypt_buffer(const ss_priv_t *priv, uint8_t *out, size_t outcap,
+    size_t *outlen, const uint8_t *in, size_t inlen);
+
+//
+// Creates an incremental encryptor / decryptor for a key, see stream.h.
+// The key handle only needs to outlive this call. The decryptor does not
+// understand compressed ciphertext from encrypt -z.
+//
+SS_API ss_encryptor_t *ss_pub_encryptor(const ss_pub_t *pub, ss_emit_t *emit, void *arg);
+SS_API ss_decryptor_t *ss_priv_decryptor(const ss_priv_t *priv, ss_emit_t *emit, void *arg);
+
+//
+// Forces the modular exponentiation backend for every key size: pow_mod,
+// window, gmp or gmp-sec.
+//
+// Returns false if there is no backend called name.
+//
+SS_API bool ss_backend_force(const char *name);
+
+//
+// Picks the backend for nbits-bit moduli by a short calibration, or reuses
+// the choice cached in tune_file (NULL: calibrate and write no file).
+//
+// Returns the name of the backend now used for that size.
+//
+SS_API const char *ss_backend_tune(size_t nbits, const char *tune_file);
@@ -0,0 +1,279 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// header files
+#include "lz.h"
+
+#define MIN_MATCH  4
+#define HASH_BITS  12
+#define MAX_OFFSET 65535
+#define STORED     0x80000000u
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash(uint32_t seq) {
+    return (seq * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24, p[1] = v >> 16, p[2] = v >> 8, p[3] = v;
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+//
+// Writes the extra bytes of a length whose nibble was saturated at 15
+//
+static size_t put_length(uint8_t *out, size_t len) {
+    size_t n = 0;
+    for (len -= 15; len >= 255; len -= 255) {
+        out[n++] = 255;
+    }
+    out[n++] = (uint8_t) len;
+    return n;
+}
+
+//
+// Appends one sequence; returns false if it does not fit in cap
+//
+static bool put_sequence(uint8_t *out, size_t *op, size_t cap, const uint8_t *lit, size_t nlit,
+    size_t offset, size_t mlen) {
+    // token, literal and match length bytes, literals and offset in the worst case
+    size_t need = 1 + nlit / 255 + 1 + nlit + 2 + mlen / 255 + 1;
+    if (cap - *op < need) {
+        return false;
+    }
+
+    uint8_t *token = &out[(*op)++];
+    *token = (uint8_t) ((nlit < 15 ? nlit : 15) << 4);
+    if (nlit >= 15) {
+        *op += put_length(out + *op, nlit);
+    }
+    memcpy(out + *op, lit, nlit);
+    *op += nlit;
+
+    if (mlen == 0) {
+        return true; // last sequence: literals only
+    }
+
+    out[(*op)++] = (uint8_t) offset;
+    out[(*op)++] = (uint8_t) (offset >> 8);
+    mlen -= MIN_MATCH;
+    *token |= (uint8_t) (mlen < 15 ? mlen : 15);
+    if (mlen >= 15) {
+        *op += put_length(out + *op, mlen);
+    }
+    return true;
+}
+
+//
+// Compresses in into out; returns 0 if the result would not be smaller than cap
+//
+static size_t compress(uint8_t *out, size_t cap, const uint8_t *in, size_t len) {
+    uint32_t table[1 << HASH_BITS] = { 0 }; // position + 1 of the last 4 bytes with each hash
+    size_t ip = 0, anchor = 0, op = 0;
+
+    while (ip + MIN_MATCH <= len) {
+        uint32_t seq = read32(in + ip);
+        uint32_t h = hash(seq);
+        size_t cand = table[h];
+        table[h] = (uint32_t) ip + 1;
+
+        if (cand == 0 || ip - (cand - 1) > MAX_OFFSET || read32(in + cand - 1) != seq) {
+            ip++;
+            continue;
+        }
+
+        size_t ref = cand - 1;
+        size_t mlen = MIN_MATCH;
+        while (ip + mlen < len && in[ref + mlen] == in[ip + mlen]) {
+            mlen++;
+        }
+        if (!put_sequence(out, &op, cap, in + anchor, ip - anchor, ip - ref, mlen)) {
+            return 0;
+        }
+        ip += mlen;
+        anchor = ip;
+    }
+
+    if (!put_sequence(out, &op, cap, in + anchor, len - anchor, 0, 0)) {
+        return 0;
+    }
+    return op;
+}
+
+//
+// Reads the extra bytes of a saturated length; returns false at the end of in
+//
+static bool get_length(const uint8_t *in, size_t inlen, size_t *ip, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip == inlen) {
+            return false;
+        }
+        b = in[(*ip)++];
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+//
+// Decompresses exactly outlen bytes from in
+//
+static bool decompress(uint8_t *out, size_t outlen, const uint8_t *in, size_t inlen) {
+    size_t ip = 0, op = 0;
+
+    while (ip < inlen) {
+        uint8_t token = in[ip++];
+
+        size_t nlit = token >> 4;
+        if (nlit == 15 && !get_length(in, inlen, &ip, &nlit)) {
+            return false;
+        }
+        if (inlen - ip < nlit || outlen - op < nlit) {
+            return false;
+        }
+        memcpy(out + op, in + ip, nlit);
+        ip += nlit;
+        op += nlit;
+
+        if (ip == inlen) {
+            break; // last sequence
+        }
+
+        if (inlen - ip < 2) {
+            return false;
+        }
+        size_t offset = in[ip] | (size_t) in[ip + 1] << 8;
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15 && !get_length(in, inlen, &ip, &mlen)) {
+            return false;
+        }
+        mlen += MIN_MATCH;
+        if (offset == 0 || offset > op || outlen - op < mlen) {
+            return false;
+        }
+
+        // byte by byte, since a match may overlap the bytes it produces
+        for (size_t i = 0; i < mlen; i++, op++) {
+            out[op] = out[op - offset];
+        }
+    }
+    return op == outlen;
+}
+
+//
+// Compresses in into a frame.
+//
+size_t lz_frame(uint8_t *out, const uint8_t *in, size_t len) {
+    size_t clen = compress(out + LZ_HEADER, len, in, len);
+
+    put32(out, (uint32_t) len);
+    if (clen == 0) {
+        memcpy(out + LZ_HEADER, in, len);
+        put32(out + 4, (uint32_t) len | STORED);
+        return LZ_HEADER + len;
+    }
+    put32(out + 4, (uint32_t) clen);
+    return LZ_HEADER + clen;
+}
+
+struct lz_decoder {
+    uint8_t frame[LZ_FRAME_MAX]; // frame being collected
+    size_t fill;
+    uint8_t out[LZ_FRAME];
+    lz_emit_t *emit;
+    void *arg;
+    bool ok;
+};
+
+//
+// Creates a decoder for a stream of frames.
+//
+lz_decoder_t *lz_decoder_init(lz_emit_t *emit, void *arg) {
+    lz_decoder_t *dec = malloc(sizeof(lz_decoder_t));
+    if (dec != NULL) {
+        dec->fill = 0;
+        dec->emit = emit;
+        dec->arg = arg;
+        dec->ok = true;
+    }
+    return dec;
+}
+
+//
+// Size of the frame being collected, once its header is in; 0 if the header is invalid
+//
+static size_t frame_size(const lz_decoder_t *dec) {
+    uint32_t raw = get32(dec->frame), stored = get32(dec->frame + 4);
+    size_t payload = stored & ~STORED;
+    if (raw > LZ_FRAME || payload > LZ_FRAME || ((stored & STORED) && payload != raw)) {
+        return 0;
+    }
+    return LZ_HEADER + payload;
+}
+
+//
+// Emits the contents of the complete frame in dec->frame
+//
+static bool emit_frame(lz_decoder_t *dec) {
+    uint32_t raw = get32(dec->frame), stored = get32(dec->frame + 4);
+    size_t payload = stored & ~STORED;
+
+    if (stored & STORED) {
+        dec->emit(dec->arg, dec->frame + LZ_HEADER, raw);
+    } else if (decompress(dec->out, raw, dec->frame + LZ_HEADER, payload)) {
+        dec->emit(dec->arg, dec->out, raw);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+//
+// Adds len bytes of frame data, emitting the contents of every frame it completes.
+//
+bool lz_decoder_update(lz_decoder_t *dec, const uint8_t *data, size_t len) {
+    while (dec->ok && len > 0) {
+        // collect the header first, then as much payload as it announces
+        size_t want = dec->fill < LZ_HEADER ? LZ_HEADER : frame_size(dec);
+        size_t take = want - dec->fill < len ? want - dec->fill : len;
+        memcpy(dec->frame + dec->fill, data, take);
+        dec->fill += take;
+        data += take;
+        len -= take;
+
+        if (dec->fill < LZ_HEADER) {
+            continue;
+        }
+        want = frame_size(dec);
+        if (want == 0) {
+            dec->ok = false;
+        } else if (dec->fill == want) {
+            dec->ok = emit_frame(dec);
+            dec->fill = 0;
+        }
+    }
+    return dec->ok;
+}
+
+//
+// Wipes and frees the decoder.
+//
+bool lz_decoder_final(lz_decoder_t *dec) {
+    bool ok = dec->ok && dec->fill == 0;
+    // frame and out hold (compressed) plaintext
+    explicit_bzero(dec, sizeof(lz_decoder_t));
+    free(dec);
+    return ok;
+}
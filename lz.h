@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Small LZ77 compressor used to shrink plaintext before it is encrypted.
+//
+// Data is cut into independent frames of at most LZ_FRAME bytes. A frame is
+//
+//   raw length (4 bytes, big endian)
+//   payload length (4 bytes, big endian; top bit set if the payload is stored raw)
+//   payload
+//
+// and the payload is a run of LZ4-style sequences: a token byte holding the
+// literal count and match length in its two nibbles (15 meaning "more length
+// bytes follow"), the literals, then a 2-byte little endian match offset. The
+// last sequence of a frame has literals only.
+//
+
+// most raw bytes in one frame
+#define LZ_FRAME (64 * 1024)
+
+// frame header size and the largest possible frame
+#define LZ_HEADER    8
+#define LZ_FRAME_MAX (LZ_HEADER + LZ_FRAME)
+
+//
+// Compresses in into a frame.
+//
+// Provides:
+//  out: the frame (stored raw if compression does not help)
+//
+// Requires:
+//  out: LZ_FRAME_MAX writable bytes
+//  in: len readable bytes, len <= LZ_FRAME
+//
+// Returns the size of the frame.
+//
+size_t lz_frame(uint8_t *out, const uint8_t *in, size_t len);
+
+//
+// Receives decompressed data as soon as a frame is complete.
+//
+typedef void lz_emit_t(void *arg, const uint8_t *data, size_t len);
+
+typedef struct lz_decoder lz_decoder_t;
+
+//
+// Creates a decoder for a stream of frames that arrives in fragments of any size.
+//
+// Returns NULL if memory could not be allocated.
+//
+lz_decoder_t *lz_decoder_init(lz_emit_t *emit, void *arg);
+
+//
+// Adds len bytes of frame data, emitting the contents of every frame it completes.
+//
+// Returns false if the data is not a valid frame stream; later calls then fail too.
+//
+bool lz_decoder_update(lz_decoder_t *dec, const uint8_t *data, size_t len);
+
+//
+// Wipes and frees the decoder, whose buffers hold plaintext.
+//
+// Returns false if decoding failed or the stream ended inside a frame.
+//
+bool lz_decoder_final(lz_decoder_t *dec);
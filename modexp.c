@@ -0,0 +1,334 @@
+#include <gmp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// header files
+#include "modexp.h"
+#include "numtheory.h"
+
+#define MAX_BACKENDS 16
+#define MAX_TUNED    32
+
+// calibration: exponent length cap, time per backend and repetition bounds
+#define CAL_EXP_BITS 512
+#define CAL_NS       20000000
+#define CAL_MIN_REPS 2
+#define CAL_MAX_REPS 1000
+
+#define WINDOW_BITS 4
+
+// The tables only grow. Writers take the lock and fill an entry before
+// publishing the new count, so readers (modexp on every block) take no lock.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static modexp_backend_t backends[MAX_BACKENDS];
+static _Atomic size_t nbackends;
+static pthread_once_t builtins_once = PTHREAD_ONCE_INIT;
+
+// per-size choices made by modexp_tune, and the modexp_force override
+static struct {
+    size_t bits;
+    _Atomic(const modexp_backend_t *) backend;
+} tuned[MAX_TUNED];
+static _Atomic size_t ntuned;
+static _Atomic(const modexp_backend_t *) forced;
+
+//
+// Left-to-right fixed window: a table of a^0..a^15, then four squarings and at
+// most one multiplication per 4 exponent bits
+//
+static void window_powm(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
+    mpz_t table[1 << WINDOW_BITS], v;
+
+    mpz_init_set_ui(table[0], 1);
+    mpz_init(table[1]);
+    mpz_mod(table[1], a, n);
+    for (size_t i = 2; i < (1 << WINDOW_BITS); i++) {
+        mpz_init(table[i]);
+        mpz_mul(table[i], table[i - 1], table[1]);
+        mpz_mod(table[i], table[i], n);
+    }
+
+    mpz_init_set_ui(v, 1);
+    size_t nwin = (mpz_sizeinbase(d, 2) + WINDOW_BITS - 1) / WINDOW_BITS;
+    for (size_t w = nwin; w-- > 0;) {
+        unsigned bits = 0;
+        for (size_t b = WINDOW_BITS; b-- > 0;) {
+            bits = bits << 1 | mpz_tstbit(d, w * WINDOW_BITS + b);
+        }
+        if (w + 1 < nwin) {
+            for (size_t s = 0; s < WINDOW_BITS; s++) {
+                mpz_mul(v, v, v);
+                mpz_mod(v, v, n);
+            }
+        }
+        if (bits != 0) {
+            mpz_mul(v, v, table[bits]);
+            mpz_mod(v, v, n);
+        }
+    }
+
+    mpz_set(o, v);
+    for (size_t i = 0; i < (1 << WINDOW_BITS); i++) {
+        mpz_clear(table[i]);
+    }
+    mpz_clear(v);
+}
+
+static void gmp_powm(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
+    mpz_powm(o, a, d, n);
+}
+
+//
+// Constant-time GMP exponentiation; it needs an odd modulus and a positive exponent
+//
+static void gmp_powm_sec(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
+    if (mpz_odd_p(n) && mpz_sgn(d) > 0) {
+        mpz_powm_sec(o, a, d, n);
+    } else {
+        mpz_powm(o, a, d, n);
+    }
+}
+
+//
+// Appends a backend; the lock must be held
+//
+static void add_backend(const char *name, modexp_fn_t *fn) {
+    size_t i = atomic_load(&nbackends);
+    backends[i].name = name;
+    backends[i].fn = fn;
+    atomic_store(&nbackends, i + 1);
+}
+
+static void register_builtins(void) {
+    pthread_mutex_lock(&lock);
+    // pow_mod first: it is the reference and the default
+    add_backend("pow_mod", pow_mod);
+    add_backend("window", window_powm);
+    add_backend("gmp", gmp_powm);
+    add_backend("gmp-sec", gmp_powm_sec);
+    pthread_mutex_unlock(&lock);
+}
+
+//
+// Adds a backend to the registry.
+//
+bool modexp_register(const char *name, modexp_fn_t *fn) {
+    pthread_once(&builtins_once, register_builtins);
+
+    pthread_mutex_lock(&lock);
+    bool ok = modexp_find(name) == NULL && atomic_load(&nbackends) < MAX_BACKENDS;
+    if (ok) {
+        add_backend(name, fn);
+    }
+    pthread_mutex_unlock(&lock);
+    return ok;
+}
+
+//
+// Looks up a backend by name.
+//
+const modexp_backend_t *modexp_find(const char *name) {
+    pthread_once(&builtins_once, register_builtins);
+    size_t count = atomic_load(&nbackends);
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(backends[i].name, name) == 0) {
+            return &backends[i];
+        }
+    }
+    return NULL;
+}
+
+//
+// Number of registered backends.
+//
+size_t modexp_count(void) {
+    pthread_once(&builtins_once, register_builtins);
+    return atomic_load(&nbackends);
+}
+
+//
+// The i-th registered backend.
+//
+const modexp_backend_t *modexp_get(size_t i) {
+    pthread_once(&builtins_once, register_builtins);
+    return i < atomic_load(&nbackends) ? &backends[i] : NULL;
+}
+
+//
+// Uses the backend called name for every modulus size.
+//
+bool modexp_force(const char *name) {
+    const modexp_backend_t *b = modexp_find(name);
+    if (b != NULL) {
+        atomic_store(&forced, b);
+    }
+    return b != NULL;
+}
+
+static void set_tuned(size_t nbits, const modexp_backend_t *b) {
+    pthread_mutex_lock(&lock);
+    size_t count = atomic_load(&ntuned), i = 0;
+    while (i < count && tuned[i].bits != nbits) {
+        i++;
+    }
+    if (i < count) {
+        atomic_store(&tuned[i].backend, b);
+    } else if (count < MAX_TUNED) {
+        tuned[count].bits = nbits;
+        atomic_store(&tuned[count].backend, b);
+        atomic_store(&ntuned, count + 1);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+//
+// The backend cached for nbits in tune_file; the last line for a size wins
+//
+static const modexp_backend_t *load_tuned(size_t nbits, const char *tune_file) {
+    FILE *f = fopen(tune_file, "r");
+    if (f == NULL) {
+        return NULL;
+    }
+
+    const modexp_backend_t *b = NULL;
+    size_t bits;
+    char name[64];
+    while (fscanf(f, "%zu %63s", &bits, name) == 2) {
+        const modexp_backend_t *found = modexp_find(name);
+        if (bits == nbits && found != NULL) {
+            b = found;
+        }
+    }
+    fclose(f);
+    return b;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+//
+// Average nanoseconds per exponentiation; UINT64_MAX if the backend disagrees with ref
+//
+static uint64_t time_backend(
+    const modexp_backend_t *b, const mpz_t ref, const mpz_t a, const mpz_t d, const mpz_t n) {
+    mpz_t o;
+    mpz_init(o);
+
+    b->fn(o, a, d, n);
+    if (mpz_cmp(o, ref) != 0) {
+        mpz_clear(o);
+        return UINT64_MAX;
+    }
+
+    uint64_t start = now_ns(), elapsed = 0;
+    size_t reps = 0;
+    while (reps < CAL_MIN_REPS || (elapsed < CAL_NS && reps < CAL_MAX_REPS)) {
+        b->fn(o, a, d, n);
+        reps++;
+        elapsed = now_ns() - start;
+    }
+
+    mpz_clear(o);
+    return elapsed / reps;
+}
+
+//
+// The fastest backend that matches pow_mod on random operands of nbits bits
+//
+static const modexp_backend_t *calibrate(size_t nbits) {
+    gmp_randstate_t rng;
+    mpz_t n, a, d, ref;
+
+    // fixed seed, so every run times the same operands
+    gmp_randinit_mt(rng);
+    gmp_randseed_ui(rng, nbits);
+    mpz_inits(n, a, d, ref, NULL);
+
+    // an odd modulus of exactly nbits bits, like pq and p^2 q
+    mpz_urandomb(n, rng, nbits);
+    mpz_setbit(n, nbits - 1);
+    mpz_setbit(n, 0);
+    mpz_urandomm(a, rng, n);
+
+    // the cost per exponent bit does not depend on its length, so cap it
+    size_t dbits = nbits < CAL_EXP_BITS ? nbits : CAL_EXP_BITS;
+    mpz_urandomb(d, rng, dbits);
+    mpz_setbit(d, dbits - 1);
+
+    const modexp_backend_t *best = modexp_get(0);
+    best->fn(ref, a, d, n);
+
+    uint64_t best_ns = UINT64_MAX;
+    for (size_t i = 0; i < modexp_count(); i++) {
+        uint64_t ns = time_backend(modexp_get(i), ref, a, d, n);
+        if (ns < best_ns) {
+            best = modexp_get(i);
+            best_ns = ns;
+        }
+    }
+
+    mpz_clears(n, a, d, ref, NULL);
+    gmp_randclear(rng);
+    return best;
+}
+
+//
+// Picks the backend for moduli of nbits bits.
+//
+const modexp_backend_t *modexp_tune(size_t nbits, const char *tune_file) {
+    const modexp_backend_t *f = atomic_load(&forced);
+    if (f != NULL) {
+        return f;
+    }
+
+    const modexp_backend_t *b = tune_file != NULL ? load_tuned(nbits, tune_file) : NULL;
+    if (b == NULL && nbits >= 2) {
+        b = calibrate(nbits);
+
+        FILE *f = tune_file != NULL ? fopen(tune_file, "a") : NULL;
+        if (f != NULL) {
+            fprintf(f, "%zu %s\n", nbits, b->name);
+            fclose(f);
+        }
+    }
+
+    if (b == NULL) {
+        b = modexp_get(0);
+    }
+    set_tuned(nbits, b);
+    return b;
+}
+
+//
+// The backend modexp uses for modulus n.
+//
+const modexp_backend_t *modexp_backend(const mpz_t n) {
+    const modexp_backend_t *f = atomic_load(&forced);
+    if (f != NULL) {
+        return f;
+    }
+
+    size_t nbits = mpz_sizeinbase(n, 2), count = atomic_load(&ntuned);
+    for (size_t i = 0; i < count; i++) {
+        if (tuned[i].bits == nbits) {
+            return atomic_load(&tuned[i].backend);
+        }
+    }
+    return modexp_get(0);
+}
+
+//
+// o = a^d (mod n) with the backend selected for n's size.
+//
+void modexp(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
+    modexp_backend(n)->fn(o, a, d, n);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdio.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// Registry of modular exponentiation backends.
+//
+// Every backend computes o = a^d (mod n) and registers itself by name. The
+// backend used for a modulus size is picked by a short calibration run
+// (modexp_tune), whose results can be cached in a tuning file, or forced with
+// modexp_force. Sizes that were never tuned use pow_mod.
+//
+// The registry and the per-size choices are process-wide and safe to change
+// while other threads call modexp; a call that races with a change uses
+// either the old or the new backend, and both give the same result. Nothing
+// in the library tunes on its own, and no file is written unless a tuning
+// file is passed to modexp_tune.
+//
+
+typedef void modexp_fn_t(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n);
+
+typedef struct {
+    const char *name;
+    modexp_fn_t *fn;
+} modexp_backend_t;
+
+//
+// Adds a backend to the registry. The built-in backends (pow_mod, window, gmp
+// and gmp-sec) register themselves on first use of the registry.
+//
+// Returns false if the name is taken or the registry is full.
+//
+bool modexp_register(const char *name, modexp_fn_t *fn);
+
+//
+// Looks up a backend by name; NULL if there is none.
+//
+const modexp_backend_t *modexp_find(const char *name);
+
+//
+// Number of registered backends, and the i-th one.
+//
+size_t modexp_count(void);
+const modexp_backend_t *modexp_get(size_t i);
+
+//
+// Uses the backend called name for every modulus size, skipping calibration.
+//
+// Returns false if there is no such backend.
+//
+bool modexp_force(const char *name);
+
+//
+// Picks the backend for moduli of nbits bits: the cached choice in tune_file if
+// there is one, otherwise the fastest backend whose results match pow_mod on a
+// short calibration run, which is then appended to tune_file (NULL: calibrate
+// every time and touch no file).
+//
+// Returns the backend that will be used.
+//
+const modexp_backend_t *modexp_tune(size_t nbits, const char *tune_file);
+
+//
+// The backend modexp uses for modulus n.
+//
+const modexp_backend_t *modexp_backend(const mpz_t n);
+
+//
+// o = a^d (mod n) with the backend selected for n's size.
+//
+void modexp(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n);
@@ -1,12 +1,17 @@
 #include <gmp.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 // header files
 #include "numtheory.h"
+#include "modexp.h"
 #include "randstate.h"
+#include "trace.h"
 
 void gcd(mpz_t g, const mpz_t a, const mpz_t b) {
     /*
@@ -131,6 +136,11 @@ void pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
 }
 
 bool is_prime(const mpz_t n, uint64_t iters) {
+    return is_prime_r(n, iters, state);
+}
+
+// Reentrant Miller-Rabin test drawing its witnesses from rng instead of the global state
+bool is_prime_r(const mpz_t n, uint64_t iters, gmp_randstate_t rng) {
     /*
  * MILLER-RABIN(n,k)
  *   write n−1 = 2^s r such that r is odd 
@@ -186,7 +196,7 @@ bool is_prime(const mpz_t n, uint64_t iters) {
     for (uint64_t i = 1; i < iters; i++) {
 
         mpz_urandomm(
-            a, state, result); // calls u_randomm which generates numbers from 0 to n-1 inclusive
+            a, rng, result); // calls u_randomm which generates numbers from 0 to n-1 inclusive
         mpz_add_ui(a, a, 2); // increments a by 2 in order to set the intverval from 2 to n-2
 
         pow_mod(y, a, r, n); // calls pow_mod to set y to a^r(mod n)
@@ -223,8 +233,384 @@ bool is_prime(const mpz_t n, uint64_t iters) {
 // Function that generates a random prime number with a given
 // number of bits, using the Miller-Rabin primality test
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters) {
+    make_prime_r(p, bits, iters, state, 1, false);
+}
+
+// Reentrant make_prime drawing candidates and witnesses from rng; candidates
+// are drawn MAKE_PRIME_BATCH at a time and the first prime of a batch is kept
+void make_prime_r(mpz_t p, uint64_t bits, uint64_t iters, gmp_randstate_t rng, size_t nthreads,
+    bool split) {
+    mpz_t cands[MAKE_PRIME_BATCH];
+    bool prime[MAKE_PRIME_BATCH];
+    for (size_t i = 0; i < MAKE_PRIME_BATCH; i++) {
+        mpz_init(cands[i]);
+    }
+
+    size_t first;
     do {
-        mpz_urandomb(p, state, bits);
+        for (size_t i = 0; i < MAKE_PRIME_BATCH; i++) {
+            mpz_urandomb(cands[i], rng, bits);
+        }
+        first = is_prime_batch(prime, cands, MAKE_PRIME_BATCH, iters, rng, nthreads, split, false);
+    } while (first == MAKE_PRIME_BATCH);
+
+    mpz_set(p, cands[first]);
+    for (size_t i = 0; i < MAKE_PRIME_BATCH; i++) {
+        mpz_clear(cands[i]);
+    }
+}
+
+// odd primes below this bound are trial divisors for is_prime_batch
+#define SIEVE_LIMIT 2048
+
+static uint32_t small_primes[SIEVE_LIMIT / 2];
+static size_t nsmall;
+static pthread_once_t small_once = PTHREAD_ONCE_INIT;
+
+static void init_small_primes(void) {
+    bool composite[SIEVE_LIMIT] = { false };
+    for (uint32_t i = 3; i < SIEVE_LIMIT; i += 2) {
+        if (!composite[i]) {
+            small_primes[nsmall++] = i;
+            for (uint32_t j = i * i; j < SIEVE_LIMIT; j += 2 * i) {
+                composite[j] = true;
+            }
+        }
+    }
+}
+
+//
+// Settles n by trial division: 1 prime, 0 composite, -1 not settled
+//
+static int sieve(const mpz_t n) {
+    if (mpz_cmp_ui(n, 2) < 0) {
+        return 0;
+    }
+    if (mpz_even_p(n)) {
+        return mpz_cmp_ui(n, 2) == 0;
+    }
+    for (size_t i = 0; i < nsmall; i++) {
+        if (mpz_divisible_ui_p(n, small_primes[i])) {
+            return mpz_cmp_ui(n, small_primes[i]) == 0;
+        }
+    }
+    // no factor below SIEVE_LIMIT settles everything below its square
+    return mpz_cmp_ui(n, (unsigned long) SIEVE_LIMIT * SIEVE_LIMIT) < 0 ? 1 : -1;
+}
+
+typedef struct {
+    mpz_srcptr n;
+    mpz_t r, n_minus, range; // n - 1 = 2^s r with r odd; witnesses are below range + 2
+    mp_bitcnt_t s;
+    uint64_t seed; // drawn before any thread starts; round i's witness derives from it
+    bool alive; // no witness has shown n composite yet
+    _Atomic uint64_t next_round; // next round to claim when rounds are split
+    _Atomic bool composite; // a split round found a witness
+} candidate_t;
+
+typedef struct {
+    candidate_t *cands;
+    size_t count;
+    uint64_t iters;
+    size_t nthreads;
+    bool split; // all threads share the rounds of one candidate at a time
+    bool all;
+    _Atomic size_t first; // lowest index proven prime so far, or count
+    pthread_mutex_t start; // held until nthreads is set to the testers actually started
+    pthread_barrier_t barrier;
+} batch_t;
+
+typedef struct {
+    batch_t *batch;
+    size_t id;
+} tester_t;
+
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15u);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+    return z ^ (z >> 31);
+}
+
+//
+// Witness of round i of one candidate, in [2, n - 2]; the same for a given
+// seed whichever thread runs the round
+//
+static void witness(mpz_t w, const candidate_t *c, uint64_t i) {
+    uint64_t x = i;
+    x = c->seed ^ splitmix64(&x);
+
+    // one spare limb keeps the bias of the reduction negligible
+    mp_size_t size = (mp_size_t) mpz_size(c->n) + 1;
+    mp_limb_t *limbs = mpz_limbs_write(w, size);
+    for (mp_size_t j = 0; j < size; j++) {
+        limbs[j] = (mp_limb_t) splitmix64(&x);
+    }
+    mpz_limbs_finish(w, size);
+    mpz_mod(w, w, c->range);
+    mpz_add_ui(w, w, 2);
+}
+
+//
+// Miller-Rabin round i of one candidate; true if its witness shows n composite
+//
+static bool composite_round(candidate_t *c, uint64_t i, mpz_t w, mpz_t y) {
+    witness(w, c, i);
+    modexp(y, w, c->r, c->n);
+    if (mpz_cmp_ui(y, 1) == 0 || mpz_cmp(y, c->n_minus) == 0) {
+        return false;
+    }
+    for (mp_bitcnt_t j = 1; j < c->s && mpz_cmp(y, c->n_minus) != 0; j++) {
+        mpz_mul(y, y, y);
+        mpz_mod(y, y, c->n);
+        if (mpz_cmp_ui(y, 1) == 0) {
+            break;
+        }
+    }
+    return mpz_cmp(y, c->n_minus) != 0;
+}
+
+//
+// Miller-Rabin rounds [from, to) of one candidate; clears alive on a witness of compositeness
+//
+static void test_rounds(candidate_t *c, uint64_t from, uint64_t to, mpz_t w, mpz_t y) {
+    for (uint64_t i = from; i < to && c->alive; i++) {
+        c->alive = !composite_round(c, i, w, y);
+    }
+}
+
+//
+// Lowers batch->first to i
+//
+static void found_prime(batch_t *batch, size_t i) {
+    size_t first = atomic_load(&batch->first);
+    while (i < first && !atomic_compare_exchange_weak(&batch->first, &first, i)) {
+    }
+}
+
+//
+// Rounds 1.. of the candidates in index order, every thread claiming rounds of
+// the same candidate until they run out or one finds a witness
+//
+static void split_rounds(tester_t *t, mpz_t w, mpz_t y) {
+    batch_t *batch = t->batch;
+
+    // alive only changes in the first pass, which every thread has finished here
+    pthread_barrier_wait(&batch->barrier);
+    for (size_t i = 0; i < batch->count; i++) {
+        candidate_t *c = &batch->cands[i];
+        if (!c->alive || (!batch->all && i > atomic_load(&batch->first))) {
+            continue;
+        }
+
+        uint64_t start = trace_now();
+        uint64_t round;
+        while (!atomic_load(&c->composite)
+               && (round = atomic_fetch_add(&c->next_round, 1)) < batch->iters) {
+            if (composite_round(c, round, w, y)) {
+                atomic_store(&c->composite, true);
+            }
+        }
+        trace_span("candidate test", start);
+
+        // every thread sees the same verdict once all of them are done with c
+        pthread_barrier_wait(&batch->barrier);
+        bool prime = !atomic_load(&c->composite);
+        if (t->id == 0) {
+            c->alive = prime;
+            if (prime) {
+                found_prime(batch, i);
+            }
+        }
+        if (prime && !batch->all) {
+            break;
+        }
+    }
+}
+
+//
+// Tester thread: candidates id, id + nthreads, ... get one round each, which
+// weeds out nearly every composite, then the rest of their rounds in index
+// order, skipping any candidate above a prime already found; with split set,
+// the rest of the rounds are shared by all threads instead
+//
+static void *tester(void *arg) {
+    tester_t *t = arg;
+    batch_t *batch = t->batch;
+    mpz_t w, y;
+    mpz_inits(w, y, NULL);
+
+    // nthreads is final once the calling thread lets go of start
+    pthread_mutex_lock(&batch->start);
+    pthread_mutex_unlock(&batch->start);
+
+    for (int pass = 0; pass < (batch->split ? 1 : 2); pass++) {
+        for (size_t i = t->id; i < batch->count; i += batch->nthreads) {
+            candidate_t *c = &batch->cands[i];
+            if (!c->alive || (!batch->all && i > atomic_load(&batch->first))) {
+                continue;
+            }
+
+            uint64_t start = trace_now();
+            test_rounds(c, pass == 0 ? 0 : 1, pass == 0 ? 1 : batch->iters, w, y);
+            trace_span("candidate test", start);
+
+            if (pass == 1 && c->alive) {
+                found_prime(batch, i);
+            }
+        }
+    }
+    if (batch->split) {
+        split_rounds(t, w, y);
+    }
+
+    mpz_clears(w, y, NULL);
+    return NULL;
+}
+
+//
+// Sets up candidate n for its Miller-Rabin rounds, drawing its seed from rng
+//
+static void candidate_init(candidate_t *c, mpz_srcptr n, gmp_randstate_t rng) {
+    c->n = n;
+    c->alive = true;
+    atomic_init(&c->next_round, 1);
+    atomic_init(&c->composite, false);
+    mpz_inits(c->r, c->n_minus, c->range, NULL);
+    mpz_sub_ui(c->n_minus, n, 1);
+    c->s = mpz_scan1(c->n_minus, 0);
+    mpz_tdiv_q_2exp(c->r, c->n_minus, c->s);
+    mpz_sub_ui(c->range, n, 3);
+    c->seed = (uint64_t) gmp_urandomb_ui(rng, 32) << 32 | gmp_urandomb_ui(rng, 32);
+}
+
+//
+// is_prime_batch one candidate at a time on the calling thread, for when the
+// batch can't be allocated; seeds are drawn as the batch draws them, so the
+// result is the same
+//
+static size_t is_prime_serial(bool prime[], mpz_t cands[], size_t count, uint64_t iters,
+    gmp_randstate_t rng, bool all) {
+    size_t first = count;
+    mpz_t w, y;
+    mpz_inits(w, y, NULL);
+    for (size_t i = 0; i < count; i++) {
+        int settled = sieve(cands[i]);
+        prime[i] = settled == 1;
+        if (settled == -1) {
+            // every survivor draws its seed, tested or not
+            candidate_t c = { 0 };
+            candidate_init(&c, cands[i], rng);
+            if (all || first == count) {
+                test_rounds(&c, 0, iters, w, y);
+                prime[i] = c.alive;
+            }
+            mpz_clears(c.r, c.n_minus, c.range, NULL);
+        }
+        if (prime[i] && first == count) {
+            first = i;
+        }
+    }
+    if (!all) {
+        for (size_t i = first + 1; i < count; i++) {
+            prime[i] = false;
+        }
+    }
+    mpz_clears(w, y, NULL);
+    return first;
+}
+
+// Miller-Rabin over a batch of candidates: trial division first, then interleaved
+// rounds on nthreads threads with witnesses derived from seeds drawn up front so
+// results don't depend on scheduling
+size_t is_prime_batch(bool prime[], mpz_t cands[], size_t count, uint64_t iters,
+    gmp_randstate_t rng, size_t nthreads, bool split, bool all) {
+    pthread_once(&small_once, init_small_primes);
+    if (iters == 0) {
+        iters = 1;
+    }
+
+    batch_t batch = { .count = count, .iters = iters, .split = split, .all = all, .first = count };
+    batch.cands = calloc(count, sizeof(candidate_t));
+    if (batch.cands == NULL) {
+        return is_prime_serial(prime, cands, count, iters, rng, all);
+    }
+
+    size_t survivors = 0;
+    for (size_t i = 0; i < count; i++) {
+        candidate_t *c = &batch.cands[i];
+        int settled = sieve(cands[i]);
+        prime[i] = settled == 1;
+        if (settled != -1) {
+            continue;
+        }
+
+        candidate_init(c, cands[i], rng);
+        survivors++;
+    }
+
+    // primes found by trial division count too
+    for (size_t i = 0; i < count; i++) {
+        if (prime[i]) {
+            found_prime(&batch, i);
+            break;
+        }
+    }
+
+    if (nthreads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? (size_t) cpus : 1;
+    }
+    // split rounds keep every thread on one candidate; otherwise each needs candidates of its own
+    size_t useful = split ? (size_t) iters - 1 : survivors;
+    if (nthreads > useful) {
+        nthreads = useful > 0 ? useful : 1;
+    }
+
+    // the calling thread is tester 0; the others wait on start until every
+    // thread that could be created is running, so they stripe over exactly those
+    tester_t *testers = calloc(nthreads, sizeof(tester_t));
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    tester_t self = { .batch = &batch, .id = 0 };
+    size_t started = 1;
+    pthread_mutex_init(&batch.start, NULL);
+    pthread_mutex_lock(&batch.start);
+    while (testers != NULL && threads != NULL && started < nthreads) {
+        testers[started] = (tester_t) { .batch = &batch, .id = started };
+        if (pthread_create(&threads[started], NULL, tester, &testers[started]) != 0) {
+            break;
+        }
+        started++;
+    }
+    batch.nthreads = started;
+    pthread_barrier_init(&batch.barrier, NULL, (unsigned) started);
+    pthread_mutex_unlock(&batch.start);
+
+    tester(&self);
+    for (size_t t = 1; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    size_t first = atomic_load(&batch.first);
+    for (size_t i = 0; i < count; i++) {
+        candidate_t *c = &batch.cands[i];
+        if (c->n == NULL) {
+            continue;
+        }
+        // without all, candidates above the first prime were not finished
+        prime[i] = c->alive && (all || i <= first);
+        mpz_clears(c->r, c->n_minus, c->range, NULL);
+    }
+    if (!all) {
+        for (size_t i = first + 1; i < count; i++) {
+            prime[i] = false;
+        }
+    }
 
-    } while (is_prime(p, iters) == false);
+    pthread_barrier_destroy(&batch.barrier);
+    pthread_mutex_destroy(&batch.start);
+    free(testers);
+    free(threads);
+    free(batch.cands);
+    return first;
 }
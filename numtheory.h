@@ -13,4 +13,41 @@ void pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n);
 
 bool is_prime(const mpz_t n, uint64_t iters);
 
+bool is_prime_r(const mpz_t n, uint64_t iters, gmp_randstate_t rng);
+
+// candidates drawn per is_prime_batch call by make_prime
+#define MAKE_PRIME_BATCH 32
+
+//
+// Tests count candidates at once: trial division by small primes, then iters
+// Miller-Rabin rounds per survivor, interleaved so that composites are dropped
+// after one round, and spread over nthreads threads (0: one per CPU); if
+// fewer threads can be created, the work is spread over those that were.
+// Each candidate left by trial division draws a seed from rng before testing
+// starts, and the witness of each of its rounds is derived from that seed, so
+// the result only depends on rng, not on the number of threads or their timing.
+//
+// With split set, each candidate's rounds after the first are shared by all
+// threads, one candidate at a time in index order, so a single large prime is
+// confirmed in about iters / nthreads rounds instead of iters; this trades
+// throughput over a batch for latency on each candidate.
+//
+// Provides:
+//  prime: prime[i] tells whether cands[i] is probably prime; unless all is set,
+//         only candidates up to the returned index are decided and later ones
+//         are reported composite
+//
+// Returns the index of the lowest probable prime, or count if there is none.
+//
+size_t is_prime_batch(bool prime[], mpz_t cands[], size_t count, uint64_t iters,
+    gmp_randstate_t rng, size_t nthreads, bool split, bool all);
+
+// make_prime searches on the calling thread
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters);
+
+//
+// Reentrant make_prime drawing from rng; nthreads and split are handed to
+// is_prime_batch and don't change the prime found for a given rng.
+//
+void make_prime_r(mpz_t p, uint64_t bits, uint64_t iters, gmp_randstate_t rng, size_t nthreads,
+    bool split);
@@ -0,0 +1,263 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// header files
+#include "pool.h"
+
+typedef struct {
+    pool_fn_t *fn;
+    void *arg;
+} task_t;
+
+// growable ring of tasks, oldest at head
+typedef struct {
+    pthread_mutex_t lock;
+    task_t *tasks;
+    size_t head, count, cap;
+} queue_t;
+
+typedef struct {
+    pool_t *pool;
+    size_t id;
+} worker_t;
+
+struct pool {
+    size_t nthreads;
+    pthread_t *threads;
+    worker_t *workers;
+    queue_t *queues;
+
+    pthread_mutex_t lock; // guards the fields below
+    pthread_cond_t work; // signalled when a task is queued or the pool stops
+    pthread_cond_t idle; // signalled when pending drops to 0
+    size_t queued; // tasks sitting in queues
+    size_t pending; // tasks submitted but not finished
+    size_t next; // queue for the next submit from outside the pool
+    bool stop;
+};
+
+// worker running on this thread, if any
+static _Thread_local worker_t *current;
+
+//
+// Appends a task, growing the ring if it is full; false if that fails
+//
+static bool queue_push(queue_t *q, task_t task) {
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->cap) {
+        size_t cap = q->cap ? 2 * q->cap : 64;
+        task_t *tasks = malloc(cap * sizeof(task_t));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&q->lock);
+            return false;
+        }
+        for (size_t i = 0; i < q->count; i++) {
+            tasks[i] = q->tasks[(q->head + i) % q->cap];
+        }
+        free(q->tasks);
+        q->tasks = tasks;
+        q->head = 0;
+        q->cap = cap;
+    }
+    q->tasks[(q->head + q->count) % q->cap] = task;
+    q->count++;
+    pthread_mutex_unlock(&q->lock);
+    return true;
+}
+
+static bool queue_take(queue_t *q, task_t *task) {
+    bool found = false;
+    pthread_mutex_lock(&q->lock);
+    if (q->count > 0) {
+        *task = q->tasks[q->head];
+        q->head = (q->head + 1) % q->cap;
+        q->count--;
+        found = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+//
+// Takes a task from the worker's own queue, or steals one from another worker
+//
+static bool find_task(worker_t *w, task_t *task) {
+    pool_t *pool = w->pool;
+    for (size_t i = 0; i < pool->nthreads; i++) {
+        if (queue_take(&pool->queues[(w->id + i) % pool->nthreads], task)) {
+            pthread_mutex_lock(&pool->lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void task_done(pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0) {
+        pthread_cond_broadcast(&pool->idle);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    pool_t *pool = w->pool;
+    current = w;
+
+    for (;;) {
+        task_t task;
+        if (find_task(w, &task)) {
+            task.fn(task.arg);
+            task_done(pool);
+            continue;
+        }
+
+        // nothing anywhere: sleep until a task is queued
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->stop) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        bool stop = pool->stop && pool->queued == 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop) {
+            return NULL;
+        }
+    }
+}
+
+//
+// Frees the queues and the pool once no worker is running
+//
+static void pool_free(pool_t *pool) {
+    for (size_t i = 0; i < pool->nthreads; i++) {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+        free(pool->queues[i].tasks);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->queues);
+    free(pool->workers);
+    free(pool->threads);
+    free(pool);
+}
+
+//
+// Stops the workers once the queues are empty and joins the first started of them
+//
+static void pool_stop(pool_t *pool, size_t started) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+}
+
+//
+// Starts a pool of nthreads workers (0: one per CPU).
+//
+pool_t *pool_create(size_t nthreads) {
+    if (nthreads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? (size_t) cpus : 1;
+    }
+
+    pool_t *pool = calloc(1, sizeof(pool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->nthreads = nthreads;
+    pool->threads = calloc(nthreads, sizeof(pthread_t));
+    pool->workers = calloc(nthreads, sizeof(worker_t));
+    pool->queues = calloc(nthreads, sizeof(queue_t));
+    if (pool->threads == NULL || pool->workers == NULL || pool->queues == NULL) {
+        free(pool->queues);
+        free(pool->workers);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (size_t i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+        pool->workers[i] = (worker_t) { .pool = pool, .id = i };
+    }
+    for (size_t i = 0; i < nthreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, &pool->workers[i]) != 0) {
+            // every queue was set up, so only the join is limited to the started workers
+            pool_stop(pool, i);
+            pool_free(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+size_t pool_size(const pool_t *pool) {
+    return pool->nthreads;
+}
+
+//
+// Queues fn(arg) on the calling worker's queue, or on the next queue in turn.
+//
+void pool_submit(pool_t *pool, pool_fn_t *fn, void *arg) {
+    // count the task before it becomes visible, so a worker taking it never
+    // decrements queued or pending below zero
+    pthread_mutex_lock(&pool->lock);
+    size_t id;
+    if (current != NULL && current->pool == pool) {
+        id = current->id;
+    } else {
+        id = pool->next;
+        pool->next = (pool->next + 1) % pool->nthreads;
+    }
+    pool->queued++;
+    pool->pending++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!queue_push(&pool->queues[id], (task_t) { .fn = fn, .arg = arg })) {
+        // no memory to grow the queue: run the task on the submitting thread
+        pthread_mutex_lock(&pool->lock);
+        pool->queued--;
+        pthread_mutex_unlock(&pool->lock);
+        fn(arg);
+        task_done(pool);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+//
+// Waits until every submitted task has finished.
+//
+void pool_wait(pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+//
+// Waits for all tasks, stops the workers and frees the pool.
+//
+void pool_destroy(pool_t *pool) {
+    pool_wait(pool);
+    pool_stop(pool, pool->nthreads);
+    pool_free(pool);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+//
+// Work-stealing thread pool.
+//
+// Every worker owns a queue of tasks. A worker runs tasks from its own queue
+// and, once that is empty, steals from the other workers' queues, so a few
+// long-running producers of tasks never leave the remaining workers idle.
+// Tasks are taken oldest first, both by owners and by thieves, which keeps
+// tasks that were submitted in order finishing roughly in order.
+//
+
+typedef void pool_fn_t(void *arg);
+
+typedef struct pool pool_t;
+
+//
+// Starts a pool of nthreads workers (0: one per CPU).
+//
+// Returns NULL if the workers could not be started.
+//
+pool_t *pool_create(size_t nthreads);
+
+//
+// Number of workers in the pool.
+//
+size_t pool_size(const pool_t *pool);
+
+//
+// Queues fn(arg). Called from a worker, the task goes to that worker's own queue;
+// otherwise tasks are spread over the workers' queues in turn. If a queue can't
+// grow to hold the task, it runs on the calling thread before pool_submit returns.
+//
+void pool_submit(pool_t *pool, pool_fn_t *fn, void *arg);
+
+//
+// Waits until every submitted task, including tasks submitted by tasks, has finished.
+//
+void pool_wait(pool_t *pool);
+
+//
+// Waits for all tasks, stops the workers and frees the pool.
+//
+void pool_destroy(pool_t *pool);
@@ -0,0 +1,431 @@
+#include <getopt.h>
+#include <gmp.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// header files
+#include "modexp.h"
+#include "pool.h"
+#include "ss.h"
+
+#define OPTIONS "i:o:d:n:t:m:M:vh"
+
+// ciphertext lines per decryption job, and new blocks per encryption job
+#define SEG_LINES  256
+#define SEG_BLOCKS 256
+
+typedef struct job job_t;
+
+typedef struct {
+    mpz_srcptr d, pq, n;
+
+    pthread_mutex_t lock; // guards done and ok of every job
+    pthread_cond_t finished; // signalled when a job is done
+} rekey_t;
+
+//
+// One segment on its way through a stage: ciphertext lines to decrypt, or
+// plaintext to encrypt under the new key. Jobs of a stage are kept in input
+// order, so their outputs are consumed in order whatever order they finish in.
+//
+struct job {
+    rekey_t *rk;
+    bool encrypt;
+    uint8_t *in, *out;
+    size_t inlen, outlen;
+    bool done, ok;
+    bool nomem; // out could not be allocated
+    job_t *next;
+};
+
+// FIFO of jobs
+typedef struct {
+    job_t *head, *tail;
+    size_t count;
+} queue_t;
+
+void print_help(void) {
+    fprintf(stderr, "SYNOPSIS\n"
+                    "   Re-encrypts SS ciphertext under a new key in one pass: every block is\n"
+                    "   decrypted with the old private key and the plaintext is encrypted with\n"
+                    "   the new public key in memory, without ever being written out.\n"
+                    "\n"
+                    "USAGE\n"
+                    "   ./rekey [OPTIONS]\n"
+                    "\n"
+                    "OPTIONS\n"
+                    "   -h              Display program help and usage.\n"
+                    "   -v              Display verbose program output.\n"
+                    "   -i infile       Ciphertext under the old key (default: stdin).\n"
+                    "   -o outfile      Ciphertext under the new key (default: stdout).\n"
+                    "   -d pvfile       Old private key file (default: ss.priv).\n"
+                    "   -n pbfile       New public key file (default: ss.pub).\n"
+                    "   -t threads      Worker threads (default: one per CPU).\n"
+                    "   -m backend      Modular exponentiation backend (pow_mod, window, gmp,\n"
+                    "                   gmp-sec; default: the fastest, measured per key size).\n"
+                    "   -M tunefile     Cache the measured backends in tunefile and reuse them.\n");
+    return;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void push(queue_t *q, job_t *job) {
+    if (q->tail != NULL) {
+        q->tail->next = job;
+    } else {
+        q->head = job;
+    }
+    q->tail = job;
+    q->count++;
+}
+
+static job_t *pop(queue_t *q) {
+    job_t *job = q->head;
+    q->head = job->next;
+    if (q->head == NULL) {
+        q->tail = NULL;
+    }
+    q->count--;
+    return job;
+}
+
+//
+// Frees a job, wiping whichever of its buffers holds plaintext
+//
+static void free_job(job_t *job) {
+    if (job->encrypt) {
+        explicit_bzero(job->in, job->inlen);
+    } else if (job->out != NULL) {
+        explicit_bzero(job->out, job->outlen);
+    }
+    free(job->in);
+    free(job->out);
+    free(job);
+}
+
+//
+// Pool task: decrypts or encrypts one segment
+//
+static void run_job(void *arg) {
+    job_t *job = arg;
+    rekey_t *rk = job->rk;
+    size_t cap = job->encrypt ? ss_encrypt_buffer_size(job->inlen, rk->n)
+                              : ss_decrypt_buffer_size(job->in, job->inlen, rk->pq);
+    bool ok = false;
+
+    job->out = malloc(cap > 0 ? cap : 1);
+    if (job->out == NULL) {
+        job->nomem = true;
+    } else if (job->encrypt) {
+        ok = ss_encrypt_buffer(job->out, cap, &job->outlen, job->in, job->inlen, rk->n);
+    } else {
+        ok = ss_decrypt_buffer(job->out, cap, &job->outlen, job->in, job->inlen, rk->d, rk->pq);
+    }
+
+    pthread_mutex_lock(&rk->lock);
+    job->ok = ok;
+    job->done = true;
+    pthread_cond_signal(&rk->finished);
+    pthread_mutex_unlock(&rk->lock);
+}
+
+//
+// Reads up to SEG_LINES ciphertext lines into a new decryption job
+//
+// Provides:
+//  job: the new job, or NULL at end of input
+//
+// Returns false if memory could not be allocated.
+//
+static bool read_segment(rekey_t *rk, FILE *infile, char **line, size_t *line_cap, job_t **job) {
+    job_t *seg = calloc(1, sizeof(job_t));
+    size_t cap = 0;
+    ssize_t len;
+
+    *job = NULL;
+    if (seg == NULL) {
+        return false;
+    }
+    seg->rk = rk;
+    for (size_t lines = 0; lines < SEG_LINES && (len = getline(line, line_cap, infile)) >= 0;
+         lines++) {
+        if (seg->inlen + (size_t) len > cap) {
+            cap = 2 * (seg->inlen + (size_t) len);
+            uint8_t *in = realloc(seg->in, cap);
+            if (in == NULL) {
+                free_job(seg);
+                return false;
+            }
+            seg->in = in;
+        }
+        memcpy(seg->in + seg->inlen, *line, (size_t) len);
+        seg->inlen += (size_t) len;
+    }
+    if (seg->inlen == 0) {
+        free_job(seg);
+        return true;
+    }
+    *job = seg;
+    return true;
+}
+
+//
+// Moves plaintext into carry and cuts it into encryption jobs of SEG_BLOCKS new
+// blocks; with last set, the remainder becomes a final, shorter job
+//
+// Returns false if memory could not be allocated.
+//
+static bool cut_segments(rekey_t *rk, pool_t *pool, queue_t *encs, uint8_t *carry,
+    size_t *carry_len, size_t span, const uint8_t *plain, size_t len, bool last) {
+    while (len > 0 || (last && *carry_len > 0)) {
+        size_t take = span - *carry_len < len ? span - *carry_len : len;
+        memcpy(carry + *carry_len, plain, take);
+        *carry_len += take;
+        plain += take;
+        len -= take;
+        if (*carry_len < span && !(last && len == 0)) {
+            break;
+        }
+
+        job_t *job = calloc(1, sizeof(job_t));
+        uint8_t *in = malloc(*carry_len);
+        if (job == NULL || in == NULL) {
+            free(job);
+            free(in);
+            return false;
+        }
+        *job = (job_t) { .rk = rk, .encrypt = true, .in = in, .inlen = *carry_len };
+        memcpy(job->in, carry, *carry_len);
+        explicit_bzero(carry, *carry_len);
+        *carry_len = 0;
+
+        push(encs, job);
+        pool_submit(pool, run_job, job);
+    }
+    return true;
+}
+
+//
+// Re-encrypts infile under n: ciphertext segments are decrypted on the pool, their
+// plaintext is re-cut on the new key's block boundaries in order, and the new
+// segments are encrypted on the pool and written in order. At most window jobs
+// are in flight, which bounds the plaintext held in memory.
+//
+// Provides:
+//  plain: plaintext bytes that went through
+//  outlen: ciphertext bytes written
+//
+// Returns false if infile holds something that is not ciphertext, outfile
+// could not be written or memory ran out.
+//
+static bool rekey(FILE *infile, FILE *outfile, rekey_t *rk, pool_t *pool, size_t window,
+    uint64_t *plain, uint64_t *outlen) {
+    queue_t decs = { 0 }, encs = { 0 };
+    size_t span = SEG_BLOCKS * (ss_block_size(rk->n) - 1), carry_len = 0;
+    uint8_t *carry = malloc(span);
+    char *line = NULL;
+    size_t line_cap = 0;
+    bool eof = false, ok = true;
+
+    *plain = *outlen = 0;
+    if (carry == NULL) {
+        fprintf(stderr, "rekey: out of memory\n");
+        return false;
+    }
+    for (;;) {
+        // keep the pool fed while the stages ahead are not full
+        while (ok && !eof && decs.count + encs.count < window) {
+            job_t *job;
+            if (!read_segment(rk, infile, &line, &line_cap, &job)) {
+                fprintf(stderr, "rekey: out of memory\n");
+                ok = false;
+                break;
+            }
+            if (job == NULL) {
+                eof = true;
+                break;
+            }
+            push(&decs, job);
+            pool_submit(pool, run_job, job);
+        }
+
+        pthread_mutex_lock(&rk->lock);
+        while ((decs.head == NULL || !decs.head->done) && (encs.head == NULL || !encs.head->done)
+               && (decs.head != NULL || encs.head != NULL)) {
+            pthread_cond_wait(&rk->finished, &rk->lock);
+        }
+        pthread_mutex_unlock(&rk->lock);
+
+        if (encs.head != NULL && encs.head->done) {
+            // new ciphertext goes out in order as soon as it is ready
+            job_t *job = pop(&encs);
+            if (ok && job->nomem) {
+                fprintf(stderr, "rekey: out of memory\n");
+                ok = false;
+            }
+            if (ok && fwrite(job->out, sizeof(uint8_t), job->outlen, outfile) != job->outlen) {
+                perror("rekey");
+                ok = false;
+            }
+            *outlen += job->outlen;
+            free_job(job);
+        } else if (decs.head != NULL && decs.head->done) {
+            job_t *job = pop(&decs);
+            if (ok && !job->ok) {
+                fprintf(stderr, job->nomem ? "rekey: out of memory\n"
+                                           : "rekey: input is not SS ciphertext\n");
+                ok = false;
+            }
+            if (ok) {
+                *plain += job->outlen;
+                if (!cut_segments(rk, pool, &encs, carry, &carry_len, span, job->out,
+                        job->outlen, eof && decs.head == NULL)) {
+                    fprintf(stderr, "rekey: out of memory\n");
+                    ok = false;
+                }
+            }
+            free_job(job);
+        } else if (ok && eof && carry_len > 0) {
+            if (!cut_segments(rk, pool, &encs, carry, &carry_len, span, NULL, 0, true)) {
+                fprintf(stderr, "rekey: out of memory\n");
+                ok = false;
+            }
+        } else {
+            break;
+        }
+    }
+
+    explicit_bzero(carry, span);
+    free(carry);
+    free(line);
+    return ok && fflush(outfile) == 0;
+}
+
+int main(int argc, char **argv) {
+    FILE *infile_h = stdin, *outfile_h = stdout, *pvfile_h, *pbfile_h;
+    char *infile = NULL, *outfile = NULL, *pvfile = "ss.priv", *pbfile = "ss.pub";
+    char *backend = NULL, *tunefile = NULL;
+    size_t nthreads = 0;
+    bool verbose = false;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'i': infile = optarg; break;
+        case 'o': outfile = optarg; break;
+        case 'd': pvfile = optarg; break;
+        case 'n': pbfile = optarg; break;
+        case 't': nthreads = (size_t) strtoul(optarg, NULL, 10); break;
+        case 'm': backend = optarg; break;
+        case 'M': tunefile = optarg; break;
+        case 'v': verbose = true; break;
+        case 'h': print_help(); return 0;
+        default: print_help(); return 1;
+        }
+    }
+
+    if (backend != NULL && !modexp_force(backend)) {
+        fprintf(stderr, "rekey: unknown backend %s; available:", backend);
+        for (size_t i = 0; i < modexp_count(); i++) {
+            fprintf(stderr, " %s", modexp_get(i)->name);
+        }
+        fprintf(stderr, "\n");
+        return 1;
+    }
+
+    pvfile_h = fopen(pvfile, "r");
+    if (pvfile_h == NULL) {
+        perror(pvfile);
+        return 1;
+    }
+    pbfile_h = fopen(pbfile, "r");
+    if (pbfile_h == NULL) {
+        perror(pbfile);
+        return 1;
+    }
+    if (infile != NULL && (infile_h = fopen(infile, "r")) == NULL) {
+        perror(infile);
+        return 1;
+    }
+
+    mpz_t d, pq, n;
+    mpz_inits(d, pq, n, NULL);
+    char username[SS_USERNAME_MAX + 1];
+    ss_read_priv(pq, d, pvfile_h);
+    ss_read_pub(n, username, pbfile_h);
+    fclose(pvfile_h);
+    fclose(pbfile_h);
+
+    // compressed ciphertext carries frames, not blocks that can be re-cut
+    int first = getc(infile_h);
+    ungetc(first, infile_h);
+    if (first == SS_LZ_HEADER[0]) {
+        fprintf(stderr, "rekey: compressed ciphertext is not supported\n");
+        return 1;
+    }
+
+    // both keys are tuned before the pool starts calling modexp
+    const modexp_backend_t *old_b = modexp_tune(mpz_sizeinbase(pq, 2), tunefile);
+    const modexp_backend_t *new_b = modexp_tune(mpz_sizeinbase(n, 2), tunefile);
+
+    if (outfile != NULL && (outfile_h = fopen(outfile, "w")) == NULL) {
+        perror(outfile);
+        return 1;
+    }
+
+    pool_t *pool = pool_create(nthreads);
+    if (pool == NULL) {
+        fprintf(stderr, "rekey: could not start worker threads\n");
+        return 1;
+    }
+    if (verbose) {
+        fprintf(stderr, "old pq: %zu bits, modexp: %s\n", mpz_sizeinbase(pq, 2), old_b->name);
+        fprintf(stderr, "new n:  %zu bits, modexp: %s, user: %s\n", mpz_sizeinbase(n, 2),
+            new_b->name, username);
+        fprintf(stderr, "threads: %zu\n", pool_size(pool));
+    }
+
+    rekey_t rk = { .d = d, .pq = pq, .n = n };
+    pthread_mutex_init(&rk.lock, NULL);
+    pthread_cond_init(&rk.finished, NULL);
+
+    uint64_t plain, outlen;
+    double start = now();
+    bool ok = rekey(infile_h, outfile_h, &rk, pool, 4 * pool_size(pool), &plain, &outlen);
+    double secs = now() - start;
+    off_t inlen = ftello(infile_h);
+
+    size_t threads = pool_size(pool);
+    pool_destroy(pool);
+    pthread_cond_destroy(&rk.finished);
+    pthread_mutex_destroy(&rk.lock);
+
+    fprintf(stderr,
+        "rekey: %" PRIu64 " bytes of plaintext (%jd in, %" PRIu64 " out) in %.3f s"
+        " (%.2f MB/s) on %zu threads%s\n",
+        plain, (intmax_t) inlen, outlen, secs, secs > 0 ? plain / secs / 1e6 : 0.0, threads,
+        ok ? "" : ", failed");
+
+    if (infile != NULL) {
+        fclose(infile_h);
+    }
+    if (outfile != NULL) {
+        ok = fclose(outfile_h) == 0 && ok;
+        if (!ok) {
+            remove(outfile);
+        }
+    }
+    mpz_clears(d, pq, n, NULL);
+    return ok ? 0 : 1;
+}
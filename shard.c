@@ -0,0 +1,245 @@
+#include <errno.h>
+#include <gmp.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// header files
+#include "shard.h"
+#include "ss.h"
+
+// bytes copied at a time while merging
+#define MERGE_CHUNK (1024 * 1024)
+
+typedef struct {
+    const char *exe, *infile, *pbfile, *backend;
+    pid_t *pids; // pid of each running job, by job index
+    size_t njobs;
+} local_t;
+
+static bool local_start(shard_transport_t *t, const shard_job_t *job) {
+    local_t *l = t->ctx;
+    if (job->index >= l->njobs) {
+        size_t njobs = 2 * job->index + 1;
+        pid_t *pids = realloc(l->pids, njobs * sizeof(pid_t));
+        if (pids == NULL) {
+            return false;
+        }
+        memset(pids + l->njobs, 0, (njobs - l->njobs) * sizeof(pid_t));
+        l->pids = pids;
+        l->njobs = njobs;
+    }
+
+    char range[64];
+    snprintf(range, sizeof(range), "%" PRIu64 ":%" PRIu64, job->offset, job->length);
+    char *argv[] = { (char *) l->exe, "-i", (char *) l->infile, "-o", job->outpath, "-n",
+        (char *) l->pbfile, "--range", range, "-m", (char *) l->backend, NULL };
+    if (l->backend == NULL) {
+        argv[9] = NULL;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        execv(l->exe, argv);
+        perror(l->exe);
+        _exit(127);
+    }
+    l->pids[job->index] = pid;
+    return true;
+}
+
+static bool local_wait(shard_transport_t *t, size_t *index, bool *ok) {
+    local_t *l = t->ctx;
+    for (;;) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        for (size_t i = 0; i < l->njobs; i++) {
+            if (l->pids[i] == pid) {
+                l->pids[i] = 0;
+                *index = i;
+                *ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                return true;
+            }
+        }
+        // not one of ours; keep waiting
+    }
+}
+
+static void local_close(shard_transport_t *t) {
+    local_t *l = t->ctx;
+    free(l->pids);
+    free(l);
+    free(t);
+}
+
+//
+// Transport running each shard as a local child process.
+//
+shard_transport_t *shard_local(
+    const char *exe, const char *infile, const char *pbfile, const char *backend) {
+    shard_transport_t *t = malloc(sizeof(shard_transport_t));
+    local_t *l = calloc(1, sizeof(local_t));
+    if (t == NULL || l == NULL) {
+        free(t);
+        free(l);
+        return NULL;
+    }
+    *l = (local_t) { .exe = exe, .infile = infile, .pbfile = pbfile, .backend = backend };
+    *t = (shard_transport_t) {
+        .start = local_start, .wait = local_wait, .close = local_close, .ctx = l
+    };
+    return t;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//
+// Appends the file at path to out
+//
+static bool append_file(FILE *out, const char *path, uint8_t *buf) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        return false;
+    }
+    size_t len;
+    bool ok = true;
+    while (ok && (len = fread(buf, sizeof(uint8_t), MERGE_CHUNK, in)) > 0) {
+        ok = fwrite(buf, sizeof(uint8_t), len, out) == len;
+    }
+    ok = ok && !ferror(in);
+    fclose(in);
+    return ok;
+}
+
+//
+// Encrypts infile into outfile in shards.
+//
+bool shard_encrypt(const char *infile, const char *outfile, const mpz_t n, size_t shards,
+    size_t parallel, shard_transport_t *transport, bool verbose) {
+    struct stat st;
+    if (stat(infile, &st) != 0) {
+        perror(infile);
+        return false;
+    }
+
+    if (parallel == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        parallel = cpus > 0 ? (size_t) cpus : 1;
+    }
+    if (shards == 0) {
+        shards = parallel;
+    }
+
+    // whole blocks per shard, so every shard but the last starts and ends on a block boundary
+    uint64_t size = (uint64_t) st.st_size, block = ss_block_size(n) - 1;
+    uint64_t blocks = (size + block - 1) / block;
+    uint64_t per = (blocks + shards - 1) / shards;
+    size_t count = per > 0 ? (size_t) ((blocks + per - 1) / per) : 0;
+
+    shard_job_t *jobs = calloc(count, sizeof(shard_job_t));
+    double *started = calloc(count, sizeof(double));
+    bool ok = count == 0 || (jobs != NULL && started != NULL);
+    for (size_t i = 0; ok && i < count; i++) {
+        jobs[i].index = i;
+        jobs[i].offset = i * per * block;
+        jobs[i].length = per * block < size - jobs[i].offset ? per * block : size - jobs[i].offset;
+        jobs[i].outpath = malloc(strlen(outfile) + 32);
+        ok = jobs[i].outpath != NULL;
+        if (ok) {
+            sprintf(jobs[i].outpath, "%s.shard.%zu", outfile, i);
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "shard: out of memory\n");
+        for (size_t i = 0; jobs != NULL && i < count; i++) {
+            free(jobs[i].outpath);
+        }
+        free(jobs);
+        free(started);
+        return false;
+    }
+
+    double start = now();
+    size_t next = 0, running = 0, failed = 0;
+    while (next < count || running > 0) {
+        // keep up to parallel shards running, and stop launching once one fails
+        while (next < count && running < parallel && failed == 0) {
+            started[next] = now();
+            if (!transport->start(transport, &jobs[next])) {
+                fprintf(stderr, "shard %zu: could not start\n", next);
+                failed++;
+                break;
+            }
+            next++, running++;
+        }
+        if (running == 0) {
+            break;
+        }
+
+        size_t i;
+        bool ok;
+        if (!transport->wait(transport, &i, &ok)) {
+            failed++;
+            break;
+        }
+        running--;
+        if (!ok) {
+            fprintf(stderr, "shard %zu: failed\n", i);
+            failed++;
+        } else if (verbose) {
+            fprintf(stderr, "shard %zu: bytes %" PRIu64 "-%" PRIu64 " in %.2f s\n", i,
+                jobs[i].offset, jobs[i].offset + jobs[i].length, now() - started[i]);
+        }
+    }
+
+    // merge in shard order; the concatenation is exactly ss_encrypt_file's output
+    ok = failed == 0;
+    if (ok) {
+        FILE *out = fopen(outfile, "w");
+        uint8_t *buf = malloc(MERGE_CHUNK);
+        ok = out != NULL && buf != NULL;
+        for (size_t i = 0; ok && i < count; i++) {
+            ok = append_file(out, jobs[i].outpath, buf);
+        }
+        ok = out != NULL && fclose(out) == 0 && ok;
+        free(buf);
+        if (!ok) {
+            perror(outfile);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        remove(jobs[i].outpath);
+        free(jobs[i].outpath);
+    }
+    free(jobs);
+    free(started);
+
+    if (verbose) {
+        double secs = now() - start;
+        fprintf(stderr, "%zu shards, %" PRIu64 " bytes in %.2f s (%.2f MB/s)%s\n", count, size,
+            secs, secs > 0 ? size / secs / 1e6 : 0.0, ok ? "" : ", failed");
+    }
+    return ok;
+}
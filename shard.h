@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdio.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// Sharded encryption of one large file by several worker processes.
+//
+// The input is cut into byte ranges that start on block boundaries (multiples
+// of k - 1 bytes), so each shard's ciphertext is exactly the matching stretch
+// of ss_encrypt_file's output. Shards are handed to a transport, which runs
+// them somewhere and reports when each one is done, and the shard outputs are
+// then concatenated in order into one ciphertext.
+//
+
+typedef struct {
+    size_t index;
+    uint64_t offset; // first input byte
+    uint64_t length; // input bytes
+    char *outpath; // where the transport leaves this shard's ciphertext
+} shard_job_t;
+
+typedef struct shard_transport shard_transport_t;
+
+//
+// Runs shard jobs. start launches a job without waiting for it; wait blocks
+// until any launched job finishes and reports which one and whether it
+// succeeded (false once no job is running); close frees the transport.
+//
+struct shard_transport {
+    bool (*start)(shard_transport_t *t, const shard_job_t *job);
+    bool (*wait)(shard_transport_t *t, size_t *index, bool *ok);
+    void (*close)(shard_transport_t *t);
+    void *ctx;
+};
+
+//
+// Transport running each shard as a local child process:
+//   exe -i infile -o outpath -n pbfile --range offset:length [-m backend]
+//
+// Requires:
+//  exe: path of the encrypt program
+//  infile, pbfile: input and public key file, readable by the children
+//  backend: modexp backend to force in the children, or NULL
+//
+// Returns NULL if memory could not be allocated.
+//
+shard_transport_t *shard_local(
+    const char *exe, const char *infile, const char *pbfile, const char *backend);
+
+//
+// Encrypts infile into outfile in shards.
+//
+// Requires:
+//  infile: regular file to encrypt
+//  outfile: output path; shard i is staged in outfile.shard.<i>
+//  n: public exponent and modulus, for the block size
+//  shards: number of shards (0: one per parallel slot)
+//  parallel: shards running at once (0: one per CPU)
+//  transport: runs the shards
+//  verbose: print a line per shard and a summary
+//
+// Returns false if a shard failed or the output could not be merged; no
+// staged shard files are left behind either way.
+//
+bool shard_encrypt(const char *infile, const char *outfile, const mpz_t n, size_t shards,
+    size_t parallel, shard_transport_t *transport, bool verbose);
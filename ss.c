@@ -1,3 +1,4 @@
+#include <ctype.h>
 #include <stdio.h>
 #include <gmp.h>
 #include <unistd.h>
@@ -8,7 +9,15 @@
 #include <inttypes.h>
 #include "randstate.h"
 #include "ss.h"
+#include "stream.h"
+#include "lz.h"
+#include "cache.h"
+#include "ckpt.h"
+#include "modexp.h"
+#include "trace.h"
 #include <time.h>
+#include <pthread.h>
+#include <string.h>
 #include <sys/stat.h>
 
 extern gmp_randstate_t state;
@@ -27,27 +36,28 @@ extern gmp_randstate_t state;
 //  all mpz_t arguments to be initialized
 //
 void ss_make_pub(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters) {
+    ss_make_pub_r(p, q, n, nbits, iters, state, 1, false);
+}
 
-    // creating p and q
+//
+// Reentrant ss_make_pub: every random choice is drawn from rng, and the prime
+// search runs on nthreads threads, splitting rounds if split is set
+//
+void ss_make_pub_r(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters,
+    gmp_randstate_t rng, size_t nthreads, bool split) {
     // [nbits/5, (2 × nbits)/5)
     uint64_t lower_bound = nbits / 5;
     uint64_t upper_bound = (2 * nbits) / 5;
 
-    uint64_t pbits = lower_bound + random() % (upper_bound - lower_bound);
-
-    make_prime(p, pbits, iters); // make first prime p
-
-    uint64_t qbits = nbits - pbits - pbits; // n - p
+    uint64_t pbits = lower_bound + gmp_urandomm_ui(rng, upper_bound - lower_bound);
+    make_prime_r(p, pbits, iters, rng, nthreads, split);
 
-    make_prime(q, qbits, iters); // make second prime p
+    uint64_t qbits = nbits - pbits - pbits;
+    make_prime_r(q, qbits, iters, rng, nthreads, split);
 
-    //creating n
-    mpz_t n_v;
-    mpz_init(n_v);
-    mpz_mul(n_v, p, p); // n = p * q
-    mpz_mul(n, n_v, q); // n = p * p * q
-
-    mpz_clear(n_v);
+    // n = p * p * q
+    mpz_mul(n, p, p);
+    mpz_mul(n, n, q);
 }
 
 //
@@ -124,11 +134,12 @@ void ss_write_priv(const mpz_t pq, const mpz_t d, FILE *pvfile) {
 //
 // Requires:
 //  pbfile: open and readable file stream
-//  username: requires sufficient space
+//  username: room for SS_USERNAME_MAX + 1 bytes
 //  all mpz_t arguments to be initialized
 //
 void ss_read_pub(mpz_t n, char username[], FILE *pbfile) {
-    gmp_fscanf(pbfile, "%Zx\n%s\n", n, username);
+    username[0] = '\0';
+    gmp_fscanf(pbfile, "%Zx\n%256s\n", n, username); // width is SS_USERNAME_MAX
 }
 
 //
@@ -159,21 +170,107 @@ void ss_read_priv(mpz_t pq, mpz_t d, FILE *pvfile) {
 //
 void ss_encrypt(mpz_t c, const mpz_t m, const mpz_t n) {
     // E(m)=c=m^n (mod n).
-    pow_mod(c, m, n, n);
+    modexp(c, m, n, n);
 }
 
 //
-// Encrypt an arbitrary file
-//
-// Provides:
-//  fills outfile with the encrypted contents of infile
+// Encrypt one prefixed block and print it as a hex line
 //
 // Requires:
-//  infile: open and readable file stream
-//  outfile: open and writable file stream
-//  n: public exponent and modulus
+//  block: 0xFF prefix followed by len data bytes
+//  m, c: initialized scratch integers
+//  hex: hex_size(n) writable bytes
+//  cache: block cache for n, or NULL
+//
+// Returns the number of bytes written, or -1 if the line could not be written.
+//
+static int encrypt_block(FILE *outfile, mpz_t m, mpz_t c, char *hex, const uint8_t *block,
+    size_t len, const mpz_t n, cache_t *cache) {
+    // a repeated block reuses its line
+    size_t digits;
+    const uint8_t *hit = cache != NULL ? cache_get(cache, block + 1, len, &digits) : NULL;
+    if (hit != NULL) {
+        uint64_t t = trace_now();
+        size_t put = fwrite(hit, sizeof(char), digits, outfile);
+        trace_span("write", t);
+        return put == digits ? (int) digits : -1;
+    }
+
+    // covert the elements of the block to m
+    uint64_t t = trace_now();
+    mpz_import(m, len + 1, 1, sizeof(uint8_t), 1, 0, block);
+    trace_span("import", t);
+
+    t = trace_now();
+    ss_encrypt(c, m, n); // call ss to get c
+    trace_span("exponentiate", t);
+
+    t = trace_now();
+    mpz_get_str(hex, 16, c);
+    digits = strlen(hex);
+    hex[digits++] = '\n';
+    trace_span("export", t);
+
+    if (cache != NULL) {
+        cache_put(cache, block + 1, len, (uint8_t *) hex, digits);
+    }
+
+    t = trace_now();
+    size_t put = fwrite(hex, sizeof(char), digits, outfile); // print to the outfile
+    trace_span("write", t);
+    return put == digits ? (int) digits : -1;
+}
+
+//
+// Room for a number below n in hex, plus the newline and terminator
+//
+static size_t hex_size(const mpz_t n) {
+    return mpz_sizeinbase(n, 16) + 2;
+}
+
+//
+// Block size k for public modulus n; each block carries k - 1 plaintext bytes
+//
+uint64_t ss_block_size(const mpz_t n) {
+    mpz_t n_squared;
+    mpz_init(n_squared);
+
+    mpz_sqrt(n_squared, n);
+    uint64_t k = (mpz_sizeinbase(n_squared, 2) - 1) / 8;
+
+    mpz_clear(n_squared);
+    return k;
+}
+
+//
+// Records progress once a checkpoint is due. The output is synced first, so a
+// checkpoint never covers more than what is on disk, and the end of it is
+// hashed from the file itself.
 //
-void ss_encrypt_file(FILE *infile, FILE *outfile, const mpz_t n) {
+static void checkpoint(FILE *outfile, ckpt_t *ck, const char *ckpt, time_t *last) {
+    if (time(NULL) - *last < CKPT_SECONDS) {
+        return;
+    }
+    fflush(outfile);
+    fsync(fileno(outfile));
+
+    uint64_t tail = ck->out_off < CKPT_TAIL ? ck->out_off : CKPT_TAIL;
+    ck->out_hash = CKPT_HASH_INIT;
+    if (!ckpt_hash_file(fileno(outfile), ck->out_off - tail, tail, &ck->out_hash)
+        || !ckpt_save(ckpt, ck)) {
+        fprintf(stderr, "%s: could not write checkpoint\n", ckpt);
+    }
+    *last = time(NULL);
+}
+
+//
+// Block loop of ss_encrypt_file over at most limit bytes; with ck set, progress is
+// tracked and checkpointed to ckpt
+//
+// Returns false if memory could not be allocated or the output could not be written.
+//
+static bool encrypt_loop(FILE *infile, FILE *outfile, const mpz_t n, uint64_t limit, ckpt_t *ck,
+    const char *ckpt) {
 
     mpz_t m, c;
     uint8_t *block;
@@ -181,32 +278,466 @@ void ss_encrypt_file(FILE *infile, FILE *outfile, const mpz_t n) {
     mpz_init(m), mpz_init(c);
 
     size_t bytes_read;
+    time_t last = time(NULL);
 
-    mpz_t n_squared;
-    mpz_init(n_squared);
-
-    mpz_sqrt(n_squared, n); // compute the square of n and store the result in n_squared
-    k = (mpz_sizeinbase(n_squared, 2) - 1) / 8;
+    k = ss_block_size(n);
 
     // initialize the planintext ciphertext
     block = (uint8_t *) calloc(k, sizeof(uint8_t));
+    char *hex = malloc(hex_size(n));
+    cache_t *cache = cache_new(CACHE_ENTRIES);
+    if (block == NULL || hex == NULL) {
+        mpz_clears(m, c, NULL);
+        free(block);
+        free(hex);
+        cache_free(cache);
+        return false;
+    }
 
     block[0] = 0xFF; // declaration of array with prefix 0xFF
 
-    while ((bytes_read = fread(block + 1, sizeof(uint8_t), k - 1, infile)) > 0) {
+    bool ok = true;
+    uint64_t t = trace_now();
+    while (limit > 0
+        && (bytes_read = fread(block + 1, sizeof(uint8_t), limit < k - 1 ? limit : k - 1, infile))
+               > 0) {
+        trace_span("read", t);
+        limit -= bytes_read;
 
         // check if these is still bytes to read
-        // covert the elements of the block to m
-        mpz_import(m, bytes_read + 1, 1, sizeof(uint8_t), 1, 0, block);
-
-        ss_encrypt(c, m, n); // call ss to get c
+        int written = encrypt_block(outfile, m, c, hex, block, bytes_read, n, cache);
+        if (written < 0) {
+            ok = false;
+            break;
+        }
 
-        gmp_fprintf(outfile, "%Zx\n", c); // print to the outfile
+        if (ck != NULL) {
+            ck->block++;
+            ck->in_off += bytes_read;
+            ck->in_hash = ckpt_hash(ck->in_hash, block + 1, bytes_read);
+            ck->out_off += (uint64_t) written;
+            checkpoint(outfile, ck, ckpt, &last);
+        }
+        t = trace_now();
     }
 
-    mpz_clears(m, c, n_squared, NULL);
+    mpz_clears(m, c, NULL);
 
     free(block);
+    free(hex);
+    cache_free(cache);
+    return ok;
+}
+
+//
+// Encrypt an arbitrary file
+//
+// Provides:
+//  fills outfile with the encrypted contents of infile
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  n: public exponent and modulus
+//
+// Returns false if memory could not be allocated or outfile could not be written.
+//
+bool ss_encrypt_file(FILE *infile, FILE *outfile, const mpz_t n) {
+    return encrypt_loop(infile, outfile, n, UINT64_MAX, NULL, NULL) && fflush(outfile) == 0;
+}
+
+//
+// Encrypt the next len bytes of a file
+//
+// Provides:
+//  fills outfile with the encryption of up to len bytes of infile, read from its
+//  current position; for ranges starting on a multiple of k - 1 bytes, this is
+//  exactly the matching stretch of ss_encrypt_file's output
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  n: public exponent and modulus
+//  len: number of bytes to encrypt
+//
+// Returns false if memory could not be allocated or outfile could not be written.
+//
+bool ss_encrypt_file_range(FILE *infile, FILE *outfile, const mpz_t n, uint64_t len) {
+    return encrypt_loop(infile, outfile, n, len, NULL, NULL) && fflush(outfile) == 0;
+}
+
+//
+// Positions infile and outfile where the checkpoint at ckpt left off
+//
+// block_bytes is the plaintext per block when encrypting, 0 when decrypting.
+//
+static bool resume_job(FILE *infile, FILE *outfile, ckpt_t *ck, const char *ckpt,
+    uint64_t block_bytes) {
+    ckpt_t saved;
+    if (!ckpt_load(ckpt, &saved)) {
+        fprintf(stderr, "%s: not a checkpoint\n", ckpt);
+        return false;
+    }
+    if (saved.decrypt != ck->decrypt || saved.key != ck->key) {
+        fprintf(stderr, "%s: checkpoint is for a different job or key\n", ckpt);
+        return false;
+    }
+
+    struct stat in_st, out_st;
+    int infd = fileno(infile), outfd = fileno(outfile);
+    if (fstat(infd, &in_st) != 0 || fstat(outfd, &out_st) != 0
+        || saved.in_off > (uint64_t) in_st.st_size || saved.out_off > (uint64_t) out_st.st_size) {
+        fprintf(stderr, "%s: input or partial output is shorter than the checkpoint\n", ckpt);
+        return false;
+    }
+
+    // the partial output must end exactly after a block
+    char last = '\n';
+    bool aligned;
+    if (block_bytes > 0) {
+        aligned = saved.in_off == saved.block * block_bytes
+                  && (saved.out_off == 0 || (pread(outfd, &last, 1, saved.out_off - 1) == 1));
+    } else {
+        aligned = saved.in_off == 0 || pread(infd, &last, 1, saved.in_off - 1) == 1;
+    }
+    if (!aligned || (last != '\n' && last != ' ')) {
+        fprintf(stderr, "%s: partial output does not end on a block\n", ckpt);
+        return false;
+    }
+
+    // the input consumed so far and the end of the output must be what the checkpoint saw
+    uint64_t in_hash = CKPT_HASH_INIT, out_hash = CKPT_HASH_INIT;
+    uint64_t tail = saved.out_off < CKPT_TAIL ? saved.out_off : CKPT_TAIL;
+    if (!ckpt_hash_file(infd, 0, saved.in_off, &in_hash) || in_hash != saved.in_hash) {
+        fprintf(stderr, "%s: input does not match the checkpoint\n", ckpt);
+        return false;
+    }
+    if (!ckpt_hash_file(outfd, saved.out_off - tail, tail, &out_hash)
+        || out_hash != saved.out_hash) {
+        fprintf(stderr, "%s: partial output does not match the checkpoint\n", ckpt);
+        return false;
+    }
+
+    // anything written after the checkpoint is redone
+    fflush(outfile);
+    if (ftruncate(outfd, (off_t) saved.out_off) != 0
+        || fseeko(outfile, (off_t) saved.out_off, SEEK_SET) != 0
+        || fseeko(infile, (off_t) saved.in_off, SEEK_SET) != 0) {
+        perror(ckpt);
+        return false;
+    }
+
+    *ck = saved;
+    return true;
+}
+
+//
+// Encrypt an arbitrary file, checkpointing progress so an interrupted job can resume
+//
+// Provides:
+//  fills outfile with the encrypted contents of infile; ckpt is rewritten every
+//  CKPT_SECONDS and removed once the job completes
+//
+// Requires:
+//  infile: open, readable and seekable file stream
+//  outfile: open, writable and seekable file stream
+//  n: public exponent and modulus
+//  ckpt: checkpoint file path
+//  resume: continue from ckpt, after validating the partial contents of outfile
+//
+// Returns false if the job can't be resumed from ckpt or outfile could not be
+// written; the checkpoint is kept either way.
+//
+bool ss_encrypt_file_ckpt(FILE *infile, FILE *outfile, const mpz_t n, const char *ckpt,
+    bool resume) {
+    ckpt_t ck = { .decrypt = false, .key = ckpt_fingerprint(n), .in_hash = CKPT_HASH_INIT };
+
+    if (resume && !resume_job(infile, outfile, &ck, ckpt, ss_block_size(n) - 1)) {
+        return false;
+    }
+
+    // a failed write keeps the checkpoint, so the job can be resumed once there is room
+    if (!encrypt_loop(infile, outfile, n, UINT64_MAX, &ck, ckpt) || fflush(outfile) != 0) {
+        perror("encrypt");
+        return false;
+    }
+    remove(ckpt);
+    return true;
+}
+
+// input is read in chunks of this many bytes and shared by all recipients
+#define MULTI_CHUNK (64 * 1024)
+
+typedef struct {
+    FILE *outfile;
+    mpz_srcptr n;
+    uint8_t *block; // 0xFF prefix followed by k - 1 data bytes
+    char *hex; // ciphertext line being written
+    uint64_t k;
+    size_t fill; // data bytes currently waiting in block
+    bool failed; // a line could not be written; the rest of the input is skipped
+    mpz_t m, c;
+} recipient_t;
+
+typedef struct {
+    recipient_t *recips;
+    size_t count;
+    size_t nthreads;
+    const uint8_t *chunk; // chunk currently being encrypted
+    size_t len;
+    bool done;
+    pthread_mutex_t gate; // held until nthreads is set to the workers actually started
+    pthread_barrier_t start, finish;
+} multi_t;
+
+typedef struct {
+    multi_t *multi;
+    size_t id;
+} worker_t;
+
+//
+// Append len bytes of input to a recipient, encrypting every block that fills up.
+//
+static void recipient_feed(recipient_t *r, const uint8_t *data, size_t len) {
+    while (len > 0 && !r->failed) {
+        size_t take = r->k - 1 - r->fill;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(r->block + 1 + r->fill, data, take);
+        r->fill += take;
+        data += take;
+        len -= take;
+
+        if (r->fill == r->k - 1) {
+            r->failed
+                = encrypt_block(r->outfile, r->m, r->c, r->hex, r->block, r->fill, r->n, NULL) < 0;
+            r->fill = 0;
+        }
+    }
+}
+
+//
+// Feeds the current chunk to recipients id, id + nthreads, ...
+//
+static void multi_feed(multi_t *multi, size_t id) {
+    for (size_t i = id; i < multi->count; i += multi->nthreads) {
+        recipient_feed(&multi->recips[i], multi->chunk, multi->len);
+    }
+}
+
+//
+// Flushes the short final block of recipients id, id + nthreads, ..., as ss_encrypt_file does
+//
+static void multi_flush(multi_t *multi, size_t id) {
+    for (size_t i = id; i < multi->count; i += multi->nthreads) {
+        recipient_t *r = &multi->recips[i];
+        if (r->fill > 0 && !r->failed) {
+            r->failed
+                = encrypt_block(r->outfile, r->m, r->c, r->hex, r->block, r->fill, r->n, NULL) < 0;
+        }
+    }
+}
+
+//
+// Worker thread: encrypts every chunk for recipients id, id + nthreads, ...
+//
+static void *multi_worker(void *arg) {
+    worker_t *w = arg;
+    multi_t *multi = w->multi;
+
+    // nthreads and the barriers are set once the calling thread lets go of gate
+    pthread_mutex_lock(&multi->gate);
+    pthread_mutex_unlock(&multi->gate);
+
+    for (;;) {
+        pthread_barrier_wait(&multi->start);
+        if (multi->done) {
+            break;
+        }
+        multi_feed(multi, w->id);
+        pthread_barrier_wait(&multi->finish);
+    }
+    multi_flush(multi, w->id);
+    return NULL;
+}
+
+//
+// Frees the recipients set up so far
+//
+static void free_recipients(recipient_t *recips, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(recips[i].block);
+        free(recips[i].hex);
+        mpz_clears(recips[i].m, recips[i].c, NULL);
+    }
+    free(recips);
+}
+
+//
+// Encrypt one input for several recipients in a single pass
+//
+// Provides:
+//  fills outfiles[i] with the encrypted contents of infile under ns[i]
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfiles: count open and writable file streams
+//  ns: count public exponents and moduli
+//  nthreads: worker threads (0: one per recipient, at most one per CPU)
+//
+// Returns false if memory could not be allocated or an output could not be written.
+//
+bool ss_encrypt_file_multi(
+    FILE *infile, FILE *outfiles[], mpz_t ns[], size_t count, size_t nthreads) {
+    if (count == 0) {
+        return true;
+    }
+    if (nthreads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? (size_t) cpus : 1;
+    }
+    if (nthreads > count) {
+        nthreads = count;
+    }
+
+    multi_t multi = { .count = count, .done = false };
+    multi.recips = calloc(count, sizeof(recipient_t));
+    if (multi.recips == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        recipient_t *r = &multi.recips[i];
+        r->outfile = outfiles[i];
+        r->n = ns[i];
+        r->k = ss_block_size(ns[i]);
+        r->block = calloc(r->k, sizeof(uint8_t));
+        r->hex = malloc(hex_size(ns[i]));
+        mpz_inits(r->m, r->c, NULL);
+        if (r->block == NULL || r->hex == NULL) {
+            free_recipients(multi.recips, i + 1);
+            return false;
+        }
+        r->block[0] = 0xFF;
+    }
+
+    // double buffer: the next chunk is read while the workers encrypt the current one
+    uint8_t *chunks[2] = { malloc(MULTI_CHUNK), malloc(MULTI_CHUNK) };
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    worker_t *workers = calloc(nthreads, sizeof(worker_t));
+    if (chunks[0] == NULL || chunks[1] == NULL || threads == NULL || workers == NULL) {
+        free(chunks[0]);
+        free(chunks[1]);
+        free(threads);
+        free(workers);
+        free_recipients(multi.recips, count);
+        return false;
+    }
+
+    // workers wait on gate until every thread that could be created is running,
+    // so the recipients are shared out among exactly those
+    size_t started = 0;
+    pthread_mutex_init(&multi.gate, NULL);
+    pthread_mutex_lock(&multi.gate);
+    while (started < nthreads) {
+        workers[started] = (worker_t) { .multi = &multi, .id = started };
+        if (pthread_create(&threads[started], NULL, multi_worker, &workers[started]) != 0) {
+            break;
+        }
+        started++;
+    }
+    multi.nthreads = started > 0 ? started : 1;
+    pthread_barrier_init(&multi.start, NULL, (unsigned) started + 1);
+    pthread_barrier_init(&multi.finish, NULL, (unsigned) started + 1);
+    pthread_mutex_unlock(&multi.gate);
+
+    int cur = 0;
+    size_t len = fread(chunks[cur], sizeof(uint8_t), MULTI_CHUNK, infile);
+    while (len > 0) {
+        multi.chunk = chunks[cur];
+        multi.len = len;
+        if (started == 0) {
+            // no worker could be started: the calling thread does all the work
+            multi_feed(&multi, 0);
+            len = fread(chunks[cur ^ 1], sizeof(uint8_t), MULTI_CHUNK, infile);
+        } else {
+            pthread_barrier_wait(&multi.start);
+            len = fread(chunks[cur ^ 1], sizeof(uint8_t), MULTI_CHUNK, infile);
+            pthread_barrier_wait(&multi.finish);
+        }
+        cur ^= 1;
+    }
+
+    if (started == 0) {
+        multi_flush(&multi, 0);
+    } else {
+        multi.done = true;
+        pthread_barrier_wait(&multi.start);
+        for (size_t t = 0; t < started; t++) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) {
+        ok = ok && !multi.recips[i].failed;
+    }
+
+    pthread_barrier_destroy(&multi.start);
+    pthread_barrier_destroy(&multi.finish);
+    pthread_mutex_destroy(&multi.gate);
+    free_recipients(multi.recips, count);
+    free(threads);
+    free(workers);
+    free(chunks[0]);
+    free(chunks[1]);
+    return ok;
+}
+
+//
+// Emit callback writing straight to a FILE *
+//
+static void write_file(void *arg, const uint8_t *data, size_t len) {
+    fwrite(data, sizeof(uint8_t), len, arg);
+}
+
+//
+// Compress and encrypt an arbitrary file
+//
+// Provides:
+//  fills outfile with the SS_LZ_HEADER line followed by the encryption of
+//  infile's contents as compressed frames
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  n: public exponent and modulus
+//
+// Returns false if memory could not be allocated.
+//
+bool ss_encrypt_file_lz(FILE *infile, FILE *outfile, const mpz_t n) {
+    uint8_t *raw = malloc(LZ_FRAME);
+    uint8_t *frame = malloc(LZ_FRAME_MAX);
+    size_t len;
+
+    // frames are block-chunked exactly like plain input would be
+    ss_encryptor_t *enc
+        = raw != NULL && frame != NULL ? ss_encryptor_init(n, write_file, outfile) : NULL;
+    if (enc == NULL) {
+        free(raw);
+        free(frame);
+        return false;
+    }
+
+    fputs(SS_LZ_HEADER, outfile);
+    while ((len = fread(raw, sizeof(uint8_t), LZ_FRAME, infile)) > 0) {
+        ss_encryptor_update(enc, frame, lz_frame(frame, raw, len));
+    }
+    ss_encryptor_final(enc);
+
+    free(raw);
+    free(frame);
+    return true;
 }
 
 //
@@ -223,44 +754,445 @@ void ss_encrypt_file(FILE *infile, FILE *outfile, const mpz_t n) {
 //
 void ss_decrypt(mpz_t m, const mpz_t c, const mpz_t d, const mpz_t pq) {
     // D(c)= m = cd (mod pq)
-    pow_mod(m, c, d, pq);
+    modexp(m, c, d, pq);
 }
 
 //
-// Decrypt a file back into its original form.
+// Emit callback handing decrypted frames to the decompressor, which remembers a failure
 //
-// Provides:
-//  fills outfile with the unencrypted data from infile
+static void feed_lz(void *arg, const uint8_t *data, size_t len) {
+    lz_decoder_update(arg, data, len);
+}
+
 //
-// Requires:
-//  infile: open and readable file stream to encrypted data
-//  outfile: open and writable file stream
-//  d: private exponent
-//  pq: private modulus
+// Decrypt the rest of a file written by ss_encrypt_file_lz and decompress it
+//
+static bool decrypt_file_lz(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq) {
+    uint8_t *chunk = malloc(LZ_FRAME);
+    size_t len;
+
+    lz_decoder_t *lz = chunk != NULL ? lz_decoder_init(write_file, outfile) : NULL;
+    ss_decryptor_t *dec = lz != NULL ? ss_decryptor_init(d, pq, feed_lz, lz) : NULL;
+    if (dec == NULL) {
+        fprintf(stderr, "decrypt: out of memory\n");
+        if (lz != NULL) {
+            lz_decoder_final(lz);
+        }
+        free(chunk);
+        return false;
+    }
+
+    bool ok = true;
+    while (ok && (len = fread(chunk, sizeof(uint8_t), LZ_FRAME, infile)) > 0) {
+        ok = ss_decryptor_update(dec, chunk, len);
+    }
+    ok = ss_decryptor_final(dec) && ok;
+    ok = lz_decoder_final(lz) && ok;
+
+    if (!ok) {
+        fprintf(stderr, "decrypt: corrupt compressed ciphertext\n");
+    }
+    free(chunk);
+    return ok;
+}
+
+//
+// Block loop of ss_decrypt_file; with ck set, progress is tracked and checkpointed to ckpt
+//
+// Returns false if the input is not ciphertext or the output could not be written.
 //
-void ss_decrypt_file(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq) {
+static bool decrypt_loop(
+    FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq, ckpt_t *ck, const char *ckpt) {
     mpz_t m, c;
     uint8_t *block;
     uint64_t k;
     size_t bytes_read;
     mpz_init(m), mpz_init(c);
+    time_t last = time(NULL);
 
     //k = (log2(mpz_get_ui(n))-1)/8;
     k = (mpz_sizeinbase(pq, 2) - 1) / 8;
 
     // initialize the plaintext and ciphertext
-    block = malloc(k * sizeof(uint8_t));
+    block = malloc((k + 1) * sizeof(uint8_t));
 
     block[0] = 0xFF; // declaration of array with prefix 0xFF
 
-    while (gmp_fscanf(infile, "%Zx \n", c) != EOF) {
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    cache_t *cache = cache_new(CACHE_ENTRIES);
 
-        ss_decrypt(m, c, d, pq);
-        mpz_export(block, &bytes_read, 1, sizeof(uint8_t), 1, 0, m);
-        fwrite(block + 1, sizeof(uint8_t), bytes_read - 1, outfile);
+    bool ok = true, done = false;
+    uint64_t t = trace_now();
+    while (!done && (line_len = getline(&line, &line_cap, infile)) >= 0) {
+        trace_span("read", t);
+        if (ck != NULL) {
+            ck->in_hash = ckpt_hash(ck->in_hash, line, (size_t) line_len);
+        }
+
+        // one block per whitespace-separated hex token; anything else is not ciphertext
+        size_t i = 0;
+        while (!done) {
+            while (i < (size_t) line_len && isspace((unsigned char) line[i])) {
+                i++;
+            }
+            if (i == (size_t) line_len) {
+                break;
+            }
+            size_t end = i;
+            while (end < (size_t) line_len && !isspace((unsigned char) line[end])) {
+                end++;
+            }
+            char *token = line + i;
+            size_t token_len = end - i;
+            i = end;
+
+            // a repeated token reuses its plaintext
+            const uint8_t *hit = cache != NULL
+                ? cache_get(cache, (uint8_t *) token, token_len, &bytes_read)
+                : NULL;
+            if (hit != NULL) {
+                memcpy(block + 1, hit, bytes_read++);
+            } else {
+                t = trace_now();
+                char saved = token[token_len];
+                token[token_len] = '\0';
+                int bad = mpz_set_str(c, token, 16);
+                token[token_len] = saved;
+                if (bad != 0) {
+                    fprintf(stderr, "decrypt: not ciphertext\n");
+                    ok = false;
+                    done = true;
+                    break;
+                }
+                trace_span("import", t);
+
+                t = trace_now();
+                ss_decrypt(m, c, d, pq);
+                trace_span("exponentiate", t);
+
+                t = trace_now();
+                mpz_export(block, &bytes_read, 1, sizeof(uint8_t), 1, 0, m);
+                trace_span("export", t);
+
+                if (cache != NULL) {
+                    cache_put(cache, (uint8_t *) token, token_len, block + 1, bytes_read - 1);
+                }
+            }
+
+            t = trace_now();
+            size_t put = fwrite(block + 1, sizeof(uint8_t), bytes_read - 1, outfile);
+            trace_span("write", t);
+            if (put != bytes_read - 1) {
+                ok = false;
+                done = true;
+                break;
+            }
+            if (ck != NULL) {
+                ck->block++;
+                ck->out_off += bytes_read - 1;
+            }
+        }
+
+        // a checkpoint only ever points at the end of a line
+        if (ck != NULL && !done) {
+            ck->in_off = (uint64_t) ftello(infile);
+            checkpoint(outfile, ck, ckpt, &last);
+        }
+        t = trace_now();
     }
 
+    free(line);
     free(block);
+    cache_free(cache);
     mpz_clear(m);
     mpz_clear(c);
+    return ok;
+}
+
+//
+// Decrypt a file back into its original form.
+//
+// Provides:
+//  fills outfile with the unencrypted data from infile, decompressing it if
+//  infile was written by ss_encrypt_file_lz
+//
+// Requires:
+//  infile: open and readable file stream to encrypted data
+//  outfile: open and writable file stream
+//  d: private exponent
+//  pq: private modulus
+//
+// Returns false if infile is not ciphertext, starts with an unknown header or
+// has corrupt compressed frames, or if outfile could not be written.
+//
+bool ss_decrypt_file(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq) {
+    // compressed ciphertext starts with a line that can't be hex
+    int first = getc(infile);
+    if (first == SS_LZ_HEADER[0]) {
+        char header[sizeof(SS_LZ_HEADER)] = { (char) first };
+        if (fgets(header + 1, sizeof(header) - 1, infile) == NULL
+            || strcmp(header, SS_LZ_HEADER) != 0) {
+            fprintf(stderr, "decrypt: unknown ciphertext header\n");
+            return false;
+        }
+        return decrypt_file_lz(infile, outfile, d, pq);
+    }
+    if (first != EOF) {
+        ungetc(first, infile);
+    }
+
+    return decrypt_loop(infile, outfile, d, pq, NULL, NULL);
+}
+
+//
+// Decrypt a file, checkpointing progress so an interrupted job can resume
+//
+// Provides:
+//  fills outfile with the unencrypted data from infile; ckpt is rewritten every
+//  CKPT_SECONDS and removed once the job completes
+//
+// Requires:
+//  infile: open, readable and seekable file stream to encrypted data
+//  outfile: open, writable and seekable file stream
+//  d: private exponent
+//  pq: private modulus
+//  ckpt: checkpoint file path
+//  resume: continue from ckpt, after validating the partial contents of outfile
+//
+// Returns false if infile is not ciphertext, the job can't be resumed from ckpt or
+// outfile could not be written; the checkpoint is kept either way.
+//
+bool ss_decrypt_file_ckpt(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq,
+    const char *ckpt, bool resume) {
+    ckpt_t ck = { .decrypt = true, .key = ckpt_fingerprint(pq), .in_hash = CKPT_HASH_INIT };
+
+    if (resume && !resume_job(infile, outfile, &ck, ckpt, 0)) {
+        return false;
+    }
+
+    // a failed write keeps the checkpoint, so the job can be resumed once there is room
+    if (!decrypt_loop(infile, outfile, d, pq, &ck, ckpt) || fflush(outfile) != 0) {
+        perror("decrypt");
+        return false;
+    }
+    remove(ckpt);
+    return true;
+}
+
+//
+// Upper bound on the size of ss_encrypt_buffer's output
+//
+// Every k - 1 bytes of input become one hex line of at most as many digits
+// as n, plus the newline.
+//
+size_t ss_encrypt_buffer_size(size_t inlen, const mpz_t n) {
+    uint64_t k = ss_block_size(n);
+    size_t blocks = (inlen + k - 2) / (k - 1);
+    return blocks * (mpz_sizeinbase(n, 16) + 1);
+}
+
+//
+// Encrypt a caller-owned buffer into a caller-owned buffer
+//
+// Each block is imported straight from in and its ciphertext is formatted
+// straight into out, so the only per-block allocations are the exponentiation
+// backend's own temporaries.
+//
+bool ss_encrypt_buffer(uint8_t *out, size_t outcap, size_t *outlen, const uint8_t *in,
+    size_t inlen, const mpz_t n) {
+    return ss_encrypt_buffer_cached(out, outcap, outlen, in, inlen, n, NULL);
+}
+
+//
+// ss_encrypt_buffer, reusing the lines of blocks found in cache
+//
+bool ss_encrypt_buffer_cached(uint8_t *out, size_t outcap, size_t *outlen, const uint8_t *in,
+    size_t inlen, const mpz_t n, cache_t *cache) {
+    uint64_t k = ss_block_size(n);
+    size_t pos = 0;
+
+    // sized once so the blocks never grow them
+    mpz_t m, c;
+    mpz_init2(m, 8 * k);
+    mpz_init2(c, mpz_sizeinbase(n, 2));
+
+    bool ok = true;
+    for (size_t off = 0; off < inlen; off += k - 1) {
+        size_t len = inlen - off < k - 1 ? inlen - off : k - 1;
+
+        size_t hit_len;
+        const uint8_t *hit = cache != NULL ? cache_get(cache, in + off, len, &hit_len) : NULL;
+        if (hit != NULL) {
+            if (outcap - pos < hit_len) {
+                ok = false;
+                break;
+            }
+            memcpy(out + pos, hit, hit_len);
+            pos += hit_len;
+            continue;
+        }
+
+        // m = 0xFF || block, with the prefix set in place instead of copied in front
+        mpz_import(m, len, 1, sizeof(uint8_t), 1, 0, in + off);
+        for (size_t bit = 8 * len; bit < 8 * len + 8; bit++) {
+            mpz_setbit(m, bit);
+        }
+
+        ss_encrypt(c, m, n);
+
+        // mpz_get_str's terminator lands where the newline goes
+        size_t digits = mpz_sizeinbase(c, 16);
+        if (outcap - pos < digits + 1) {
+            ok = false;
+            break;
+        }
+        mpz_get_str((char *) out + pos, 16, c);
+        out[pos + digits] = '\n';
+        if (cache != NULL) {
+            cache_put(cache, in + off, len, out + pos, digits + 1);
+        }
+        pos += digits + 1;
+    }
+
+    mpz_clears(m, c, NULL);
+    *outlen = pos;
+    return ok;
+}
+
+static int hex_value(uint8_t ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+    if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
+    return -1;
+}
+
+static bool is_space(uint8_t ch) {
+    return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r' || ch == '\v' || ch == '\f';
+}
+
+//
+// Upper bound on the size of ss_decrypt_buffer's output
+//
+// Counts the ciphertext blocks in in; each decrypts to fewer bytes than pq has.
+//
+size_t ss_decrypt_buffer_size(const uint8_t *in, size_t inlen, const mpz_t pq) {
+    size_t blocks = 0;
+    bool in_token = false;
+
+    for (size_t i = 0; i < inlen; i++) {
+        bool space = is_space(in[i]);
+        if (!space && !in_token) {
+            blocks++;
+        }
+        in_token = !space;
+    }
+    return blocks * ((mpz_sizeinbase(pq, 2) + 7) / 8);
+}
+
+//
+// Parse the hex digits in[0..digits) directly into the limbs of c
+//
+static void import_hex(mpz_t c, const uint8_t *in, size_t digits) {
+    const size_t per_limb = GMP_NUMB_BITS / 4;
+    size_t nlimbs = (digits + per_limb - 1) / per_limb;
+
+    mp_limb_t *limbs = mpz_limbs_write(c, nlimbs);
+    for (size_t i = 0; i < nlimbs; i++) {
+        limbs[i] = 0;
+    }
+    for (size_t i = 0; i < digits; i++) {
+        size_t shift = digits - 1 - i; // digit position counted from the least significant
+        limbs[shift / per_limb] |= (mp_limb_t) hex_value(in[i]) << (4 * (shift % per_limb));
+    }
+    mpz_limbs_finish(c, nlimbs);
+}
+
+//
+// Decrypt a caller-owned buffer of hex ciphertext into a caller-owned buffer
+//
+// Each ciphertext line is parsed straight into limbs and each plaintext block is
+// exported straight into out, so the only per-block allocations are the
+// exponentiation backend's own temporaries.
+//
+bool ss_decrypt_buffer(uint8_t *out, size_t outcap, size_t *outlen, const uint8_t *in,
+    size_t inlen, const mpz_t d, const mpz_t pq) {
+    return ss_decrypt_buffer_cached(out, outcap, outlen, in, inlen, d, pq, NULL);
+}
+
+//
+// ss_decrypt_buffer, reusing the plaintext of lines found in cache
+//
+bool ss_decrypt_buffer_cached(uint8_t *out, size_t outcap, size_t *outlen, const uint8_t *in,
+    size_t inlen, const mpz_t d, const mpz_t pq, cache_t *cache) {
+    size_t pos = 0;
+
+    // sized once so the blocks never grow them
+    mpz_t m, c;
+    mpz_init2(m, mpz_sizeinbase(pq, 2));
+    mpz_init2(c, mpz_sizeinbase(pq, 2) * 3);
+
+    bool ok = true;
+    size_t i = 0;
+    while (ok) {
+        while (i < inlen && is_space(in[i])) {
+            i++;
+        }
+        if (i == inlen) {
+            break;
+        }
+
+        size_t start = i;
+        while (i < inlen && hex_value(in[i]) >= 0) {
+            i++;
+        }
+        if (i == start || (i < inlen && !is_space(in[i]))) {
+            ok = false; // not a hex ciphertext line
+            break;
+        }
+
+        size_t hit_len;
+        const uint8_t *hit
+            = cache != NULL ? cache_get(cache, in + start, i - start, &hit_len) : NULL;
+        if (hit != NULL) {
+            if (outcap - pos < hit_len) {
+                ok = false;
+                break;
+            }
+            memcpy(out + pos, hit, hit_len);
+            pos += hit_len;
+            continue;
+        }
+
+        import_hex(c, in + start, i - start);
+        ss_decrypt(m, c, d, pq);
+
+        // drop the 0xFF prefix byte, keeping any leading zero bytes of the block
+        size_t bytes = (mpz_sizeinbase(m, 2) + 7) / 8;
+        size_t plain = bytes - 1;
+        if (outcap - pos < plain) {
+            ok = false;
+            break;
+        }
+        mpz_tdiv_r_2exp(m, m, 8 * plain);
+
+        size_t count = mpz_sgn(m) == 0 ? 0 : (mpz_sizeinbase(m, 2) + 7) / 8;
+        memset(out + pos, 0, plain - count);
+        mpz_export(out + pos + plain - count, NULL, 1, sizeof(uint8_t), 1, 0, m);
+        if (cache != NULL) {
+            cache_put(cache, in + start, i - start, out + pos, plain);
+        }
+        pos += plain;
+    }
+
+    mpz_clears(m, c, NULL);
+    *outlen = pos;
+    return ok;
 }
@@ -5,6 +5,12 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+// block cache, see cache.h
+typedef struct cache cache_t;
+
+// first line of a compressed ciphertext; no hex ciphertext line can start with it
+#define SS_LZ_HEADER "lz\n"
+
 //
 // Generates the components for a new SS key.
 //
@@ -20,6 +26,18 @@
 //
 void ss_make_pub(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters);
 
+//
+// Reentrant ss_make_pub.
+//
+// Same as ss_make_pub, but every random choice is drawn from rng instead of
+// random() and the global random state, so it is safe to call concurrently
+// with distinct rng states. Primes are searched on nthreads threads (0: one
+// per CPU), sharing each candidate's rounds if split is set; neither changes
+// the key generated from a given rng.
+//
+void ss_make_pub_r(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters,
+    gmp_randstate_t rng, size_t nthreads, bool split);
+
 //
 // Generates components for a new SS private key.
 //
@@ -54,6 +72,9 @@ void ss_write_pub(const mpz_t n, const char username[], FILE *pbfile);
 //
 void ss_write_priv(const mpz_t pq, const mpz_t d, FILE *pvfile);
 
+// longest keyholder name ss_read_pub stores
+#define SS_USERNAME_MAX 256
+
 //
 // Import SS public key from input stream
 //
@@ -63,7 +84,7 @@ void ss_write_priv(const mpz_t pq, const mpz_t d, FILE *pvfile);
 //
 // Requires:
 //  pbfile: open and readable file stream
-//  username: requires sufficient space
+//  username: room for SS_USERNAME_MAX + 1 bytes; longer names are cut short
 //  all mpz_t arguments to be initialized
 //
 void ss_read_pub(mpz_t n, char username[], FILE *pbfile);
@@ -94,6 +115,17 @@ void ss_read_priv(mpz_t pq, mpz_t d, FILE *pvfile);
 //
 void ss_encrypt(mpz_t c, const mpz_t m, const mpz_t n);
 
+//
+// Block size used to encrypt under public modulus n
+//
+// Provides:
+//  k: each block carries k - 1 plaintext bytes behind the 0xFF prefix
+//
+// Requires:
+//  n: public exponent and modulus
+//
+uint64_t ss_block_size(const mpz_t n);
+
 //
 // Encrypt an arbitrary file
 //
@@ -105,7 +137,86 @@ void ss_encrypt(mpz_t c, const mpz_t m, const mpz_t n);
 //  outfile: open and writable file stream
 //  n: public exponent and modulus
 //
-void ss_encrypt_file(FILE *infile, FILE *outfile, const mpz_t n);
+// Returns false if memory could not be allocated or outfile could not be written.
+//
+bool ss_encrypt_file(FILE *infile, FILE *outfile, const mpz_t n);
+
+//
+// Encrypt the next len bytes of a file
+//
+// Provides:
+//  fills outfile with the encryption of up to len bytes of infile, read from its
+//  current position; for ranges starting on a multiple of k - 1 bytes, this is
+//  exactly the matching stretch of ss_encrypt_file's output
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  n: public exponent and modulus
+//  len: number of bytes to encrypt
+//
+// Returns false if memory could not be allocated or outfile could not be written.
+//
+bool ss_encrypt_file_range(FILE *infile, FILE *outfile, const mpz_t n, uint64_t len);
+
+//
+// Encrypt an arbitrary file, checkpointing progress so an interrupted job can resume
+//
+// Provides:
+//  fills outfile with the encrypted contents of infile; ckpt is rewritten every
+//  CKPT_SECONDS with the blocks written so far and removed once the job completes
+//
+// Requires:
+//  infile: open, readable and seekable file stream
+//  outfile: open, writable and seekable file stream
+//  n: public exponent and modulus
+//  ckpt: checkpoint file path
+//  resume: continue from ckpt, after validating the partial contents of outfile
+//
+// Returns false if the job can't be resumed from ckpt or outfile could not be
+// written; the checkpoint is kept either way.
+//
+bool ss_encrypt_file_ckpt(
+    FILE *infile, FILE *outfile, const mpz_t n, const char *ckpt, bool resume);
+
+//
+// Encrypt one file for several recipients, reading the input only once
+//
+// Provides:
+//  fills outfiles[i] with the encrypted contents of infile under ns[i],
+//  identical to what ss_encrypt_file would produce for that key
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfiles: count open and writable file streams
+//  ns: count public exponents and moduli
+//  count: number of recipients
+//  nthreads: worker threads (0: one per recipient, at most one per CPU); if
+//            fewer can be started, the work is shared among those that were
+//
+// Returns false if memory could not be allocated or an output could not be
+// written; the other outputs are still completed.
+//
+bool ss_encrypt_file_multi(
+    FILE *infile, FILE *outfiles[], mpz_t ns[], size_t count, size_t nthreads);
+
+//
+// Compress and encrypt an arbitrary file
+//
+// Provides:
+//  fills outfile with the SS_LZ_HEADER line followed by the encryption of
+//  infile's contents as compressed frames (see lz.h); ss_decrypt_file
+//  recognizes the header and decompresses transparently, but the buffer and
+//  stream decryptors do not and reject it as not ciphertext
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  n: public exponent and modulus
+//
+// Returns false if memory could not be allocated.
+//
+bool ss_encrypt_file_lz(FILE *infile, FILE *outfile, const mpz_t n);
 
 //
 // Decrypt number c into number m
@@ -125,7 +236,8 @@ void ss_decrypt(mpz_t m, const mpz_t c, const mpz_t d, const mpz_t pq);
 // Decrypt a file back into its original form.
 //
 // Provides:
-//  fills outfile with the unencrypted data from infile
+//  fills outfile with the unencrypted data from infile, decompressing it if
+//  infile was written by ss_encrypt_file_lz
 //
 // Requires:
 //  infile: open and readable file stream to encrypted data
@@ -133,4 +245,103 @@ void ss_decrypt(mpz_t m, const mpz_t c, const mpz_t d, const mpz_t pq);
 //  d: private exponent
 //  pq: private modulus
 //
-void ss_decrypt_file(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq);
+// Returns false if infile is not ciphertext, starts with an unknown header or
+// has corrupt compressed frames, or if outfile could not be written.
+//
+bool ss_decrypt_file(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq);
+
+//
+// Size of the output buffer ss_encrypt_buffer needs for inlen bytes of input.
+// Ciphertext lines have no leading zeros, so the actual output may be shorter.
+//
+// Requires:
+//  inlen: number of plaintext bytes
+//  n: public exponent and modulus
+//
+size_t ss_encrypt_buffer_size(size_t inlen, const mpz_t n);
+
+//
+// Encrypt an in-memory buffer, producing the same text as ss_encrypt_file
+//
+// Provides:
+//  out: the encrypted contents of in
+//  outlen: number of bytes written to out
+//
+// Requires:
+//  out: outcap writable bytes, ss_encrypt_buffer_size(inlen, n) always suffices
+//  in: inlen readable bytes
+//  n: public exponent and modulus
+//
+// Returns false if out is too small; outlen then covers the complete lines written.
+//
+bool ss_encrypt_buffer(uint8_t *out, size_t outcap, size_t *outlen, const uint8_t *in,
+    size_t inlen, const mpz_t n);
+
+//
+// ss_encrypt_buffer, reusing the lines of blocks found in cache
+//
+// Requires:
+//  cache: block cache used only with n and by this thread, or NULL
+//
+bool ss_encrypt_buffer_cached(uint8_t *out, size_t outcap, size_t *outlen, const uint8_t *in,
+    size_t inlen, const mpz_t n, cache_t *cache);
+
+//
+// Size of the output buffer ss_decrypt_buffer needs for the ciphertext in in.
+// The final block is usually short, so the actual output may be shorter.
+//
+// Requires:
+//  in: inlen readable bytes of ciphertext
+//  pq: private modulus
+//
+size_t ss_decrypt_buffer_size(const uint8_t *in, size_t inlen, const mpz_t pq);
+
+//
+// Decrypt an in-memory buffer of ciphertext, as ss_decrypt_file does for files
+// (compressed ciphertext from ss_encrypt_file_lz is not understood)
+//
+// Provides:
+//  out: the unencrypted data from in
+//  outlen: number of bytes written to out
+//
+// Requires:
+//  out: outcap writable bytes, ss_decrypt_buffer_size(in, inlen, pq) always suffices
+//  in: inlen readable bytes of ciphertext
+//  d: private exponent
+//  pq: private modulus
+//
+// Returns false if in is not ciphertext or out is too small; outlen then covers
+// the blocks decrypted so far.
+//
+bool ss_decrypt_buffer(uint8_t *out, size_t outcap, size_t *outlen, const uint8_t *in,
+    size_t inlen, const mpz_t d, const mpz_t pq);
+
+//
+// ss_decrypt_buffer, reusing the plaintext of lines found in cache
+//
+// Requires:
+//  cache: block cache used only with d and pq and by this thread, or NULL
+//
+bool ss_decrypt_buffer_cached(uint8_t *out, size_t outcap, size_t *outlen, const uint8_t *in,
+    size_t inlen, const mpz_t d, const mpz_t pq, cache_t *cache);
+
+//
+// Decrypt a file, checkpointing progress so an interrupted job can resume
+//
+// Provides:
+//  fills outfile with the unencrypted data from infile; ckpt is rewritten every
+//  CKPT_SECONDS with the blocks written so far and removed once the job completes
+//
+// Requires:
+//  infile: open, readable and seekable file stream to (uncompressed) encrypted data
+//  outfile: open, writable and seekable file stream
+//  d: private exponent
+//  pq: private modulus
+//  ckpt: checkpoint file path
+//  resume: continue from ckpt, after validating the partial contents of outfile
+//
+// Returns false if infile is not ciphertext, the job can't be resumed from ckpt or
+// outfile could not be written; the checkpoint is kept either way.
+//
+bool ss_decrypt_file_ckpt(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq,
+    const char *ckpt, bool resume);
@@ -0,0 +1,506 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// header files
+#include "libss.h"
+
+#define OPTIONS "k:t:N:x:a:m:M:i:s:vh"
+
+// most key sizes and message size buckets
+#define MAX_KEYS    8
+#define MAX_BUCKETS 16
+
+// bytes handed to the stream API per update call
+#define STREAM_CHUNK 4096
+
+typedef struct {
+    size_t size; // messages in this bucket are (size / 2, size] bytes
+    unsigned weight;
+} bucket_t;
+
+typedef struct {
+    size_t key; // index into keys
+    size_t len;
+    uint64_t enc_ns, dec_ns;
+    bool ok;
+} result_t;
+
+typedef struct {
+    size_t nkeys;
+    uint64_t bits[MAX_KEYS];
+    ss_pub_t *pubs[MAX_KEYS];
+    ss_priv_t *privs[MAX_KEYS];
+
+    size_t nbuckets;
+    bucket_t buckets[MAX_BUCKETS];
+    unsigned total_weight;
+
+    bool stream; // drive the stream API instead of the buffer API
+    uint64_t seed;
+    size_t count;
+    result_t *results;
+    _Atomic size_t next; // next message to run
+} load_t;
+
+typedef struct {
+    load_t *load;
+    uint64_t rng; // xorshift state of this worker
+} worker_t;
+
+// growable byte buffer filled by the stream API's emit callback
+typedef struct {
+    uint8_t *data;
+    size_t len, cap;
+    bool failed; // a chunk could not be stored
+} sink_t;
+
+void print_help(void) {
+    fprintf(stderr, "SYNOPSIS\n"
+                    "   Generates a synthetic workload for the SS library, checks that every\n"
+                    "   message round-trips, and reports throughput and latency percentiles.\n"
+                    "\n"
+                    "USAGE\n"
+                    "   ./ssload [OPTIONS]\n"
+                    "\n"
+                    "OPTIONS\n"
+                    "   -h              Display program help and usage.\n"
+                    "   -v              Display verbose program output.\n"
+                    "   -k bits,...     Key sizes; messages use them in turn (default: 512).\n"
+                    "   -t threads      Concurrent workers (default: one per CPU).\n"
+                    "   -N messages     Messages to send (default: 1000).\n"
+                    "   -x mix          Message sizes as size:weight,... with k and m suffixes;\n"
+                    "                   each message of a bucket has between size/2 and size\n"
+                    "                   bytes (default: 64:89,1k:10,256k:1).\n"
+                    "   -a api          Library path: buffer or stream (default: buffer).\n"
+                    "   -m backend      Modular exponentiation backend (default: tuned per key\n"
+                    "                   size).\n"
+                    "   -M tunefile     Cache the tuned backends in tunefile and reuse them.\n"
+                    "   -i iterations   Miller-Rabin iterations for the generated keys\n"
+                    "                   (default: 50).\n"
+                    "   -s seed         Seed for the keys and the workload (default: 1).\n");
+    return;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+//
+// Parses a size with an optional k or m suffix; 0 if it is not one
+//
+static size_t parse_size(const char *s, char **end) {
+    size_t size = (size_t) strtoull(s, end, 10);
+    if (**end == 'k' || **end == 'K') {
+        size <<= 10, (*end)++;
+    } else if (**end == 'm' || **end == 'M') {
+        size <<= 20, (*end)++;
+    }
+    return *end == s ? 0 : size;
+}
+
+//
+// Parses a -x mix such as 64:89,1k:10,256k:1
+//
+static bool parse_mix(load_t *load, const char *mix) {
+    load->nbuckets = 0;
+    load->total_weight = 0;
+
+    char *p = (char *) mix;
+    while (*p != '\0') {
+        if (load->nbuckets == MAX_BUCKETS) {
+            return false;
+        }
+        bucket_t *b = &load->buckets[load->nbuckets++];
+        b->size = parse_size(p, &p);
+        if (b->size == 0 || *p != ':') {
+            return false;
+        }
+        char *weight = p + 1;
+        b->weight = (unsigned) strtoul(weight, &p, 10);
+        if (p == weight || (*p != ',' && *p != '\0')) {
+            return false;
+        }
+        load->total_weight += b->weight;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return load->total_weight > 0;
+}
+
+//
+// Parses a -k list such as 512,1024
+//
+static bool parse_keys(load_t *load, const char *list) {
+    load->nkeys = 0;
+
+    char *p = (char *) list;
+    while (*p != '\0') {
+        if (load->nkeys == MAX_KEYS) {
+            return false;
+        }
+        char *start = p;
+        load->bits[load->nkeys++] = strtoull(start, &p, 10);
+        if (p == start || (*p != ',' && *p != '\0')) {
+            return false;
+        }
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return load->nkeys > 0;
+}
+
+static size_t draw_size(const load_t *load, uint64_t *rng) {
+    unsigned pick = (unsigned) (next_random(rng) % load->total_weight);
+    const bucket_t *b = load->buckets;
+    while (pick >= b->weight) {
+        pick -= b->weight;
+        b++;
+    }
+    size_t low = b->size / 2;
+    return low + 1 + (size_t) (next_random(rng) % (b->size - low));
+}
+
+static void sink_emit(void *arg, const uint8_t *data, size_t len) {
+    sink_t *sink = arg;
+    if (sink->failed) {
+        return;
+    }
+    if (sink->cap - sink->len < len) {
+        size_t cap = 2 * (sink->len + len);
+        uint8_t *data = realloc(sink->data, cap);
+        if (data == NULL) {
+            sink->failed = true;
+            return;
+        }
+        sink->data = data;
+        sink->cap = cap;
+    }
+    memcpy(sink->data + sink->len, data, len);
+    sink->len += len;
+}
+
+//
+// Encrypts in through the stream API into sink, in STREAM_CHUNK pieces
+//
+static bool stream_encrypt(const ss_pub_t *pub, sink_t *sink, const uint8_t *in, size_t len) {
+    ss_encryptor_t *enc = ss_pub_encryptor(pub, sink_emit, sink);
+    bool ok = enc != NULL;
+    for (size_t off = 0; ok && off < len; off += STREAM_CHUNK) {
+        size_t take = len - off < STREAM_CHUNK ? len - off : STREAM_CHUNK;
+        ok = ss_encryptor_update(enc, in + off, take);
+    }
+    return enc != NULL && ss_encryptor_final(enc) && ok && !sink->failed;
+}
+
+static bool stream_decrypt(const ss_priv_t *priv, sink_t *sink, const uint8_t *in, size_t len) {
+    ss_decryptor_t *dec = ss_priv_decryptor(priv, sink_emit, sink);
+    bool ok = dec != NULL;
+    for (size_t off = 0; ok && off < len; off += STREAM_CHUNK) {
+        size_t take = len - off < STREAM_CHUNK ? len - off : STREAM_CHUNK;
+        ok = ss_decryptor_update(dec, in + off, take);
+    }
+    return dec != NULL && ss_decryptor_final(dec) && ok && !sink->failed;
+}
+
+//
+// Sends one message through encrypt and decrypt and records the latencies
+//
+static void run_message(const load_t *load, result_t *r, uint64_t *rng) {
+    const ss_pub_t *pub = load->pubs[r->key];
+    const ss_priv_t *priv = load->privs[r->key];
+
+    uint8_t *plain = malloc(r->len + 1);
+    if (plain == NULL) {
+        fprintf(stderr, "ssload: out of memory\n");
+        r->ok = false;
+        return;
+    }
+    for (size_t i = 0; i < r->len; i++) {
+        plain[i] = (uint8_t) next_random(rng);
+    }
+
+    sink_t ct = { 0 }, pt = { 0 };
+    uint64_t t = now_ns();
+    if (load->stream) {
+        r->ok = stream_encrypt(pub, &ct, plain, r->len);
+    } else {
+        ct.cap = ss_pub_encrypt_size(pub, r->len);
+        ct.data = malloc(ct.cap + 1);
+        ct.failed = ct.data == NULL;
+        r->ok = !ct.failed && ss_pub_encrypt_buffer(pub, ct.data, ct.cap, &ct.len, plain, r->len);
+    }
+    r->enc_ns = now_ns() - t;
+
+    t = now_ns();
+    if (r->ok && load->stream) {
+        r->ok = stream_decrypt(priv, &pt, ct.data, ct.len);
+    } else if (r->ok) {
+        pt.cap = ss_priv_decrypt_size(priv, ct.data, ct.len);
+        pt.data = malloc(pt.cap + 1);
+        pt.failed = pt.data == NULL;
+        r->ok = !pt.failed
+            && ss_priv_decrypt_buffer(priv, pt.data, pt.cap, &pt.len, ct.data, ct.len);
+    }
+    r->dec_ns = now_ns() - t;
+
+    if (ct.failed || pt.failed) {
+        fprintf(stderr, "ssload: out of memory\n");
+    }
+    r->ok = r->ok && pt.len == r->len && (r->len == 0 || memcmp(pt.data, plain, r->len) == 0);
+
+    free(plain);
+    free(ct.data);
+    free(pt.data);
+}
+
+static void *load_worker(void *arg) {
+    worker_t *w = arg;
+    load_t *load = w->load;
+
+    size_t i;
+    while ((i = atomic_fetch_add(&load->next, 1)) < load->count) {
+        run_message(load, &load->results[i], &w->rng);
+    }
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+//
+// Nearest-rank percentile of sorted latencies, in microseconds
+//
+static double percentile(const uint64_t *sorted, size_t n, double p) {
+    size_t rank = (size_t) (p * n + 0.999999);
+    return sorted[rank > 0 ? rank - 1 : 0] / 1e3;
+}
+
+//
+// Prints one report line for the messages of key (SIZE_MAX: all keys)
+//
+static void report(const load_t *load, size_t key, bool decrypt) {
+    uint64_t *lat = malloc(load->count * sizeof(uint64_t));
+    if (lat == NULL) {
+        fprintf(stderr, "ssload: out of memory\n");
+        return;
+    }
+    size_t n = 0;
+    uint64_t bytes = 0, busy = 0;
+    for (size_t i = 0; i < load->count; i++) {
+        const result_t *r = &load->results[i];
+        if (key == SIZE_MAX || r->key == key) {
+            lat[n++] = decrypt ? r->dec_ns : r->enc_ns;
+            bytes += r->len;
+            busy += decrypt ? r->dec_ns : r->enc_ns;
+        }
+    }
+    if (n == 0) {
+        free(lat);
+        return;
+    }
+    qsort(lat, n, sizeof(uint64_t), compare_u64);
+
+    char label[32];
+    if (key == SIZE_MAX) {
+        snprintf(label, sizeof(label), "all");
+    } else {
+        snprintf(label, sizeof(label), "%" PRIu64 "-bit", load->bits[key]);
+    }
+
+    // per-operation throughput is bytes over the time spent in that operation,
+    // summed over workers; the overall line below divides by wall time instead
+    printf("%-8s %-8s %8zu %10.2f %12.1f %12.1f %12.1f %12.1f\n", decrypt ? "decrypt" : "encrypt",
+        label, n, busy > 0 ? bytes / (busy / 1e9) / 1e6 : 0.0, percentile(lat, n, 0.50),
+        percentile(lat, n, 0.99), percentile(lat, n, 0.999), lat[n - 1] / 1e3);
+    free(lat);
+}
+
+int main(int argc, char **argv) {
+    load_t load = { .count = 1000, .seed = 1 };
+    size_t nthreads = 0;
+    uint64_t iters = 50;
+    char *backend = NULL, *tunefile = NULL;
+    bool verbose = false;
+
+    parse_keys(&load, "512");
+    parse_mix(&load, "64:89,1k:10,256k:1");
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'k':
+            if (!parse_keys(&load, optarg)) {
+                fprintf(stderr, "ssload: bad key sizes %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'x':
+            if (!parse_mix(&load, optarg)) {
+                fprintf(stderr, "ssload: bad mix %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'a':
+            if (strcmp(optarg, "stream") != 0 && strcmp(optarg, "buffer") != 0) {
+                fprintf(stderr, "ssload: unknown api %s\n", optarg);
+                return 1;
+            }
+            load.stream = strcmp(optarg, "stream") == 0;
+            break;
+        case 't': nthreads = (size_t) strtoul(optarg, NULL, 10); break;
+        case 'N': load.count = (size_t) strtoull(optarg, NULL, 10); break;
+        case 'm': backend = optarg; break;
+        case 'M': tunefile = optarg; break;
+        case 'i': iters = (uint64_t) strtoull(optarg, NULL, 10); break;
+        case 's': load.seed = (uint64_t) strtoull(optarg, NULL, 10); break;
+        case 'v': verbose = true; break;
+        case 'h': print_help(); return 0;
+        default: print_help(); return 1;
+        }
+    }
+
+    if (nthreads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? (size_t) cpus : 1;
+    }
+
+    if (backend != NULL && !ss_backend_force(backend)) {
+        fprintf(stderr, "ssload: unknown backend %s\n", backend);
+        return 1;
+    }
+
+    // keys are generated in memory, so a run touches no key files; each one is
+    // generated again with split rounds on every thread, which must give the same key
+    ss_rng_t *rng = ss_rng_new(load.seed), *split_rng = ss_rng_new(load.seed);
+    if (rng == NULL || split_rng == NULL) {
+        fprintf(stderr, "ssload: out of memory\n");
+        return 1;
+    }
+    ss_rng_threads(split_rng, nthreads, true);
+    for (size_t k = 0; k < load.nkeys; k++) {
+        ss_pub_t *split_pub;
+        ss_priv_t *split_priv;
+        if (!ss_keygen(&load.pubs[k], &load.privs[k], load.bits[k], iters, "ssload", rng)
+            || !ss_keygen(&split_pub, &split_priv, load.bits[k], iters, "ssload", split_rng)) {
+            fprintf(stderr, "ssload: could not generate a %" PRIu64 "-bit key\n", load.bits[k]);
+            return 1;
+        }
+        mpz_t n, split_n;
+        mpz_inits(n, split_n, NULL);
+        ss_pub_get_n(n, load.pubs[k]);
+        ss_pub_get_n(split_n, split_pub);
+        bool same = mpz_cmp(n, split_n) == 0;
+        mpz_clears(n, split_n, NULL);
+        ss_pub_free(split_pub);
+        ss_priv_free(split_priv);
+        if (!same) {
+            fprintf(stderr, "ssload: %" PRIu64 "-bit key differs when rounds are split\n",
+                load.bits[k]);
+            return 1;
+        }
+        const char *enc = ss_backend_tune(ss_pub_bits(load.pubs[k]), tunefile);
+        const char *dec = ss_backend_tune(ss_priv_bits(load.privs[k]), tunefile);
+        if (verbose) {
+            fprintf(stderr, "key %" PRIu64 ": n %zu bits (%s), pq %zu bits (%s)\n", load.bits[k],
+                ss_pub_bits(load.pubs[k]), enc, ss_priv_bits(load.privs[k]), dec);
+        }
+    }
+    ss_rng_free(rng);
+    ss_rng_free(split_rng);
+
+    // the workload is fixed up front, so runs with the same seed send the same messages
+    load.results = calloc(load.count, sizeof(result_t));
+    if (load.results == NULL) {
+        fprintf(stderr, "ssload: out of memory\n");
+        return 1;
+    }
+    uint64_t draw = load.seed * 2654435761u + 1;
+    for (size_t i = 0; i < load.count; i++) {
+        load.results[i].key = i % load.nkeys;
+        load.results[i].len = draw_size(&load, &draw);
+    }
+
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    worker_t *workers = calloc(nthreads, sizeof(worker_t));
+    if (threads == NULL || workers == NULL) {
+        fprintf(stderr, "ssload: out of memory\n");
+        return 1;
+    }
+
+    // workers take messages in turn, so if fewer threads start, those share the load
+    uint64_t start = now_ns();
+    size_t started = 0;
+    for (size_t t = 0; t < nthreads; t++) {
+        workers[t] = (worker_t) { .load = &load, .rng = load.seed + t * 0x9E3779B97F4A7C15u + 1 };
+        if (pthread_create(&threads[t], NULL, load_worker, &workers[t]) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        load_worker(&workers[0]);
+    }
+    for (size_t t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    double wall = (now_ns() - start) / 1e9;
+    if (started < nthreads) {
+        fprintf(stderr, "ssload: started only %zu of %zu threads\n", started, nthreads);
+        nthreads = started > 0 ? started : 1;
+    }
+
+    uint64_t bytes = 0;
+    size_t failed = 0;
+    for (size_t i = 0; i < load.count; i++) {
+        bytes += load.results[i].len;
+        failed += !load.results[i].ok;
+        if (verbose && !load.results[i].ok) {
+            fprintf(stderr, "message %zu (%zu bytes): round trip failed\n", i,
+                load.results[i].len);
+        }
+    }
+
+    printf("%-8s %-8s %8s %10s %12s %12s %12s %12s\n", "op", "key", "msgs", "MB/s", "p50 us",
+        "p99 us", "p999 us", "max us");
+    for (int decrypt = 0; decrypt < 2; decrypt++) {
+        for (size_t k = 0; k < load.nkeys && load.nkeys > 1; k++) {
+            report(&load, k, decrypt);
+        }
+        report(&load, SIZE_MAX, decrypt);
+    }
+    printf("%zu messages, %.2f MB in %.2f s with %zu threads (%s api): %.2f MB/s, %.1f msgs/s, "
+           "%zu failed\n",
+        load.count, bytes / 1e6, wall, nthreads, load.stream ? "stream" : "buffer",
+        wall > 0 ? bytes / wall / 1e6 : 0.0, wall > 0 ? load.count / wall : 0.0, failed);
+
+    for (size_t k = 0; k < load.nkeys; k++) {
+        ss_pub_free(load.pubs[k]);
+        ss_priv_free(load.privs[k]);
+    }
+    free(load.results);
+    free(threads);
+    free(workers);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,284 @@
+#include <ctype.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// header files
+#include "cache.h"
+#include "ss.h"
+#include "stream.h"
+
+// most blocks handed to the buffer API (and emitted) at once
+#define STREAM_BLOCKS 64
+
+struct ss_encryptor {
+    mpz_t n;
+    uint64_t k;
+    uint8_t *pending; // plaintext of the block being filled
+    size_t fill; // bytes in pending
+    uint8_t *out; // ciphertext of up to STREAM_BLOCKS blocks
+    size_t outcap;
+    cache_t *cache; // lines of recently seen blocks
+    ss_emit_t *emit;
+    void *arg;
+    bool ok;
+};
+
+struct ss_decryptor {
+    mpz_t d, pq;
+    uint8_t *token; // ciphertext line split across updates
+    size_t tlen, tcap;
+    uint8_t *out; // plaintext of up to STREAM_BLOCKS blocks
+    size_t outcap;
+    cache_t *cache; // plaintext of recently seen lines
+    ss_emit_t *emit;
+    void *arg;
+    bool ok;
+};
+
+//
+// Creates an encryptor for public key n.
+//
+ss_encryptor_t *ss_encryptor_init(const mpz_t n, ss_emit_t *emit, void *arg) {
+    ss_encryptor_t *enc = calloc(1, sizeof(ss_encryptor_t));
+    if (enc == NULL) {
+        return NULL;
+    }
+
+    mpz_init_set(enc->n, n);
+    enc->k = ss_block_size(n);
+    enc->outcap = ss_encrypt_buffer_size(STREAM_BLOCKS * (enc->k - 1), n);
+    enc->pending = malloc(enc->k - 1);
+    enc->out = malloc(enc->outcap);
+    enc->cache = cache_new(CACHE_ENTRIES);
+    enc->emit = emit;
+    enc->arg = arg;
+    enc->ok = true;
+
+    if (enc->pending == NULL || enc->out == NULL || enc->cache == NULL) {
+        enc->ok = false;
+        ss_encryptor_final(enc);
+        return NULL;
+    }
+    return enc;
+}
+
+//
+// Encrypts whole blocks (and at most STREAM_BLOCKS of them) and emits the result
+//
+static bool encrypt_run(ss_encryptor_t *enc, const uint8_t *data, size_t len) {
+    size_t outlen;
+    if (!ss_encrypt_buffer_cached(enc->out, enc->outcap, &outlen, data, len, enc->n, enc->cache)) {
+        enc->ok = false;
+        return false;
+    }
+    enc->emit(enc->arg, enc->out, outlen);
+    return true;
+}
+
+//
+// Adds len bytes of plaintext, emitting the ciphertext of every block it completes.
+//
+bool ss_encryptor_update(ss_encryptor_t *enc, const uint8_t *data, size_t len) {
+    size_t block = enc->k - 1;
+    if (!enc->ok) {
+        return false;
+    }
+
+    // top up a block started by an earlier update
+    if (enc->fill > 0) {
+        size_t take = block - enc->fill < len ? block - enc->fill : len;
+        memcpy(enc->pending + enc->fill, data, take);
+        enc->fill += take;
+        data += take;
+        len -= take;
+
+        if (enc->fill < block) {
+            return true;
+        }
+        enc->fill = 0;
+        if (!encrypt_run(enc, enc->pending, block)) {
+            return false;
+        }
+    }
+
+    // whole blocks are encrypted in place, without copying them
+    while (len >= block) {
+        size_t blocks = len / block < STREAM_BLOCKS ? len / block : STREAM_BLOCKS;
+        if (!encrypt_run(enc, data, blocks * block)) {
+            return false;
+        }
+        data += blocks * block;
+        len -= blocks * block;
+    }
+
+    memcpy(enc->pending, data, len);
+    enc->fill = len;
+    return true;
+}
+
+//
+// Emits the final short block, if any, and wipes and frees the encryptor.
+//
+bool ss_encryptor_final(ss_encryptor_t *enc) {
+    if (enc->ok && enc->fill > 0) {
+        encrypt_run(enc, enc->pending, enc->fill);
+    }
+    bool ok = enc->ok;
+
+    // pending holds plaintext
+    mpz_clear(enc->n);
+    if (enc->pending != NULL) {
+        explicit_bzero(enc->pending, enc->k - 1);
+    }
+    free(enc->pending);
+    free(enc->out);
+    cache_free(enc->cache);
+    free(enc);
+    return ok;
+}
+
+//
+// Creates a decryptor for private key (d, pq).
+//
+ss_decryptor_t *ss_decryptor_init(const mpz_t d, const mpz_t pq, ss_emit_t *emit, void *arg) {
+    ss_decryptor_t *dec = calloc(1, sizeof(ss_decryptor_t));
+    if (dec == NULL) {
+        return NULL;
+    }
+
+    mpz_init_set(dec->d, d);
+    mpz_init_set(dec->pq, pq);
+
+    // c < n = p * pq < pq^2, so a line has at most twice the digits of pq
+    dec->tcap = 2 * mpz_sizeinbase(pq, 16) + 1;
+    dec->outcap = STREAM_BLOCKS * ((mpz_sizeinbase(pq, 2) + 7) / 8);
+    dec->token = malloc(dec->tcap);
+    dec->out = malloc(dec->outcap);
+    dec->cache = cache_new(CACHE_ENTRIES);
+    dec->emit = emit;
+    dec->arg = arg;
+    dec->ok = true;
+
+    if (dec->token == NULL || dec->out == NULL || dec->cache == NULL) {
+        dec->ok = false;
+        ss_decryptor_final(dec);
+        return NULL;
+    }
+    return dec;
+}
+
+//
+// Decrypts up to STREAM_BLOCKS complete lines and emits the result
+//
+static bool decrypt_run(ss_decryptor_t *dec, const uint8_t *data, size_t len) {
+    size_t outlen;
+    if (!ss_decrypt_buffer_cached(
+            dec->out, dec->outcap, &outlen, data, len, dec->d, dec->pq, dec->cache)) {
+        dec->ok = false;
+        return false;
+    }
+    dec->emit(dec->arg, dec->out, outlen);
+    return true;
+}
+
+//
+// Decrypts text made only of complete lines, STREAM_BLOCKS lines at a time
+//
+static bool decrypt_text(ss_decryptor_t *dec, const uint8_t *data, size_t len) {
+    size_t start = 0, tokens = 0;
+    bool in_token = false;
+
+    for (size_t i = 0; i < len; i++) {
+        bool space = isspace(data[i]);
+        if (!space && !in_token) {
+            if (tokens == STREAM_BLOCKS) {
+                if (!decrypt_run(dec, data + start, i - start)) {
+                    return false;
+                }
+                start = i;
+                tokens = 0;
+            }
+            tokens++;
+        }
+        in_token = !space;
+    }
+    return tokens == 0 || decrypt_run(dec, data + start, len - start);
+}
+
+//
+// Keeps the start of a line that continues in the next update
+//
+static bool keep_token(ss_decryptor_t *dec, const uint8_t *data, size_t len) {
+    if (dec->tcap - dec->tlen < len) {
+        dec->ok = false; // longer than any ciphertext for this key
+        return false;
+    }
+    memcpy(dec->token + dec->tlen, data, len);
+    dec->tlen += len;
+    return true;
+}
+
+//
+// Adds len bytes of ciphertext text, emitting the plaintext of every line it completes.
+//
+bool ss_decryptor_update(ss_decryptor_t *dec, const uint8_t *data, size_t len) {
+    if (!dec->ok) {
+        return false;
+    }
+
+    // finish the line left over by an earlier update
+    if (dec->tlen > 0) {
+        size_t i = 0;
+        while (i < len && !isspace(data[i])) {
+            i++;
+        }
+        if (!keep_token(dec, data, i)) {
+            return false;
+        }
+        if (i == len) {
+            return true;
+        }
+        size_t tlen = dec->tlen;
+        dec->tlen = 0;
+        if (!decrypt_run(dec, dec->token, tlen)) {
+            return false;
+        }
+        data += i;
+        len -= i;
+    }
+
+    // everything up to the last whitespace is complete lines, decrypted in place
+    size_t end = len;
+    while (end > 0 && !isspace(data[end - 1])) {
+        end--;
+    }
+    if (!decrypt_text(dec, data, end)) {
+        return false;
+    }
+    return keep_token(dec, data + end, len - end);
+}
+
+//
+// Decrypts a final line left without a trailing newline, and wipes and frees the decryptor.
+//
+bool ss_decryptor_final(ss_decryptor_t *dec) {
+    if (dec->ok && dec->tlen > 0) {
+        decrypt_run(dec, dec->token, dec->tlen);
+    }
+    bool ok = dec->ok;
+
+    // out holds plaintext
+    mpz_clears(dec->d, dec->pq, NULL);
+    if (dec->out != NULL) {
+        explicit_bzero(dec->out, dec->outcap);
+    }
+    free(dec->token);
+    free(dec->out);
+    cache_free(dec->cache);
+    free(dec);
+    return ok;
+}
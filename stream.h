@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdio.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// marks the functions exported by libss.so; everything else stays internal
+#ifndef SS_API
+#define SS_API __attribute__((visibility("default")))
+#endif
+
+//
+// Incremental (push-style) SS encryption and decryption.
+//
+// Data is handed over in fragments of any size with update(); partial blocks
+// are buffered inside the object and every block that completes is passed to
+// the emit callback straight away. Nothing ever reads or waits, so the objects
+// can be driven from an event loop. The output is identical to
+// ss_encrypt_file / ss_decrypt_file on the concatenated input. Compressed
+// ciphertext (see ss_encrypt_file_lz) is only read by ss_decrypt_file; the
+// decryptor rejects it as not ciphertext.
+//
+
+//
+// Receives output as soon as it is available. data is only valid during the call.
+//
+typedef void ss_emit_t(void *arg, const uint8_t *data, size_t len);
+
+typedef struct ss_encryptor ss_encryptor_t;
+typedef struct ss_decryptor ss_decryptor_t;
+
+//
+// Creates an encryptor for public key n.
+//
+// Requires:
+//  n: public exponent and modulus
+//  emit: called with every completed run of ciphertext lines
+//  arg: passed through to emit
+//
+// Returns NULL if memory could not be allocated.
+//
+SS_API ss_encryptor_t *ss_encryptor_init(const mpz_t n, ss_emit_t *emit, void *arg);
+
+//
+// Adds len bytes of plaintext, emitting the ciphertext of every block it completes.
+//
+// Returns false if the ciphertext could not be produced.
+//
+SS_API bool ss_encryptor_update(ss_encryptor_t *enc, const uint8_t *data, size_t len);
+
+//
+// Emits the final short block, if any, and frees the encryptor, wiping the
+// plaintext it still holds.
+//
+// Returns false if this or any earlier update failed.
+//
+SS_API bool ss_encryptor_final(ss_encryptor_t *enc);
+
+//
+// Creates a decryptor for private key (d, pq).
+//
+// Requires:
+//  d: private exponent
+//  pq: private modulus
+//  emit: called with every completed run of plaintext
+//  arg: passed through to emit
+//
+// Returns NULL if memory could not be allocated.
+//
+SS_API ss_decryptor_t *ss_decryptor_init(
+    const mpz_t d, const mpz_t pq, ss_emit_t *emit, void *arg);
+
+//
+// Adds len bytes of ciphertext text, emitting the plaintext of every line it completes.
+//
+// Returns false if the input is not ciphertext for this key; later calls then fail too.
+//
+SS_API bool ss_decryptor_update(ss_decryptor_t *dec, const uint8_t *data, size_t len);
+
+//
+// Decrypts a final line left without a trailing newline and frees the
+// decryptor, wiping the plaintext it still holds.
+//
+// Returns false if this or any earlier update failed.
+//
+SS_API bool ss_decryptor_final(ss_decryptor_t *dec);
@@ -0,0 +1,135 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// header files
+#include "trace.h"
+
+// A slot's seq is 2 * index + 1 while the span of that index is being written
+// and 2 * index + 2 once it is complete. The fields are atomics so that a
+// writer one lap behind can't tear them; it finds the slot taken and drops
+// its span instead.
+typedef struct {
+    _Atomic uint64_t seq;
+    _Atomic(const char *) name;
+    _Atomic uint64_t start, end; // nanoseconds since trace_open
+    _Atomic uint32_t tid;
+} event_t;
+
+static event_t *ring; // NULL while tracing is off
+static size_t cap;
+static _Atomic uint64_t head; // spans claimed so far
+static _Atomic uint32_t next_tid;
+static uint64_t epoch;
+
+// small per-thread id, assigned on the thread's first span
+static _Thread_local uint32_t tid;
+
+static uint64_t clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+//
+// Starts tracing into a ring of capacity spans.
+//
+bool trace_open(size_t capacity) {
+    ring = calloc(capacity, sizeof(event_t));
+    if (ring == NULL) {
+        return false;
+    }
+    cap = capacity;
+    atomic_store(&head, 0);
+    epoch = clock_ns();
+    return true;
+}
+
+//
+// Start time of a span: the current trace time, or 0 while tracing is off.
+//
+uint64_t trace_now(void) {
+    return ring != NULL ? clock_ns() - epoch : 0;
+}
+
+//
+// Records a span called name that began at start and ends now.
+//
+void trace_span(const char *name, uint64_t start) {
+    if (ring == NULL) {
+        return;
+    }
+    if (tid == 0) {
+        tid = atomic_fetch_add(&next_tid, 1) + 1;
+    }
+
+    uint64_t idx = atomic_fetch_add_explicit(&head, 1, memory_order_relaxed);
+    event_t *e = &ring[idx % cap];
+
+    // claim the slot only if it is idle and holds an older span
+    uint64_t seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+    if (seq % 2 == 1 || seq > 2 * idx
+        || !atomic_compare_exchange_strong_explicit(
+            &e->seq, &seq, 2 * idx + 1, memory_order_acquire, memory_order_relaxed)) {
+        return;
+    }
+    atomic_store_explicit(&e->name, name, memory_order_relaxed);
+    atomic_store_explicit(&e->start, start, memory_order_relaxed);
+    atomic_store_explicit(&e->end, clock_ns() - epoch, memory_order_relaxed);
+    atomic_store_explicit(&e->tid, tid, memory_order_relaxed);
+    atomic_store_explicit(&e->seq, 2 * idx + 2, memory_order_release);
+}
+
+//
+// Stops tracing and writes the recorded spans to path as trace-event JSON.
+//
+bool trace_close(const char *path) {
+    event_t *events = ring;
+    ring = NULL;
+    if (events == NULL) {
+        return false;
+    }
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        free(events);
+        return false;
+    }
+
+    uint64_t end = atomic_load(&head);
+    uint64_t first = end > cap ? end - cap : 0;
+    uint64_t dropped = first;
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    bool comma = false;
+    for (uint64_t idx = first; idx < end; idx++) {
+        event_t *e = &events[idx % cap];
+
+        // a slot is only trusted if it holds this index before and after the copy
+        uint64_t seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+        const char *name = atomic_load_explicit(&e->name, memory_order_relaxed);
+        uint64_t start = atomic_load_explicit(&e->start, memory_order_relaxed);
+        uint64_t stop = atomic_load_explicit(&e->end, memory_order_relaxed);
+        uint32_t t = atomic_load_explicit(&e->tid, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (seq != 2 * idx + 2 || atomic_load_explicit(&e->seq, memory_order_relaxed) != seq) {
+            dropped++;
+            continue;
+        }
+        fprintf(f,
+            "%s{\"name\":\"%s\",\"cat\":\"ss\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+            "\"ts\":%.3f,\"dur\":%.3f}",
+            comma ? ",\n" : "", name, t, start / 1e3, (stop - start) / 1e3);
+        comma = true;
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%llu}}\n",
+        (unsigned long long) dropped);
+
+    bool ok = fclose(f) == 0;
+    free(events);
+    return ok;
+}
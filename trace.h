@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Timeline tracing in the Chrome trace-event format (chrome://tracing, Perfetto).
+//
+// Spans are recorded into a fixed-size ring: a writer claims a slot with an
+// atomic increment and a compare-and-swap and never blocks, and once the ring
+// is full the oldest spans are overwritten. A writer that finds its slot still
+// being written by another thread drops its span. While tracing is off, a span
+// still costs the calls to trace_now and trace_span, each of which tests a
+// pointer and returns.
+//
+// trace_open and trace_close are not thread-safe; call them before and after
+// the traced work.
+//
+
+// spans kept by default, the most recent ones
+#define TRACE_EVENTS (1 << 18)
+
+//
+// Starts tracing into a ring of capacity spans.
+//
+// Returns false if the ring could not be allocated.
+//
+bool trace_open(size_t capacity);
+
+//
+// Start time of a span: the current trace time, or 0 while tracing is off.
+//
+uint64_t trace_now(void);
+
+//
+// Records a span called name that began at start (from trace_now) and ends now.
+//
+// Requires:
+//  name: a string that outlives the trace, usually a literal
+//
+void trace_span(const char *name, uint64_t start);
+
+//
+// Stops tracing and writes the recorded spans to path as trace-event JSON.
+//
+// Returns false if the file could not be written.
+//
+bool trace_close(const char *path);
@@ -0,0 +1,454 @@
+#include <errno.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// header files
+#include "stream.h"
+#include "uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+//
+// Returns true if fd can be driven through the ring (a regular file).
+//
+bool uring_supports(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define URING_BUFS     4 // reads, and separately writes, kept in flight
+#define URING_BUF_SIZE (1024 * 1024)
+#define URING_ENTRIES  (2 * URING_BUFS)
+
+enum { OP_READ, OP_WRITE };
+
+typedef struct {
+    uint8_t *buf;
+    uint64_t off; // file offset of buf[0]
+    size_t want; // bytes to transfer (while filling a write: bytes in buf)
+    size_t done; // bytes transferred so far
+    bool busy; // request in flight
+} slot_t;
+
+struct uring {
+    int fd;
+    bool fixed; // buffers registered with the kernel
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned queued; // sqes not yet submitted to the kernel
+
+    uint8_t *mem; // backing store of every slot
+    slot_t reads[URING_BUFS], writes[URING_BUFS];
+
+    // state of the file being processed
+    int infd, outfd;
+    uint64_t outoff; // where the next write goes
+    int cur_write; // write slot being filled
+    int error; // first errno seen
+};
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+//
+// Sets up a ring and its buffers.
+//
+uring_t *uring_open(void) {
+    uring_t *ring = calloc(1, sizeof(uring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->sq_ring = ring->cq_ring = ring->sqes = MAP_FAILED;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring->fd = sys_setup(URING_ENTRIES, &p);
+
+    // plain IORING_OP_READ/WRITE arrived together with IORING_FEAT_RW_CUR_POS
+    if (ring->fd < 0 || !(p.features & IORING_FEAT_RW_CUR_POS)) {
+        uring_close(ring);
+        return NULL;
+    }
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        uring_close(ring);
+        return NULL;
+    }
+
+    uint8_t *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + p.sq_off.array);
+    ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    ring->mem = aligned_alloc(4096, 2 * URING_BUFS * URING_BUF_SIZE);
+    if (ring->mem == NULL) {
+        uring_close(ring);
+        return NULL;
+    }
+
+    // reads use buffers 0..URING_BUFS-1, writes the rest
+    struct iovec iov[2 * URING_BUFS];
+    for (int i = 0; i < 2 * URING_BUFS; i++) {
+        iov[i].iov_base = ring->mem + (size_t) i * URING_BUF_SIZE;
+        iov[i].iov_len = URING_BUF_SIZE;
+    }
+    for (int i = 0; i < URING_BUFS; i++) {
+        ring->reads[i].buf = iov[i].iov_base;
+        ring->writes[i].buf = iov[URING_BUFS + i].iov_base;
+    }
+
+    // registration can fail on a tight RLIMIT_MEMLOCK; unregistered buffers still work
+    ring->fixed = sys_register(ring->fd, IORING_REGISTER_BUFFERS, iov, 2 * URING_BUFS) == 0;
+    return ring;
+}
+
+//
+// Tears down a ring created by uring_open.
+//
+void uring_close(uring_t *ring) {
+    if (ring == NULL) {
+        return;
+    }
+    if (ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    free(ring->mem);
+    free(ring);
+}
+
+//
+// Queues the rest of a slot's transfer; it is submitted by the next reap
+//
+static void queue(uring_t *ring, int op, int index) {
+    slot_t *slot = op == OP_READ ? &ring->reads[index] : &ring->writes[index];
+    unsigned tail = *ring->sq_tail;
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    if (op == OP_READ) {
+        sqe->opcode = ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = ring->infd;
+        sqe->buf_index = index;
+    } else {
+        sqe->opcode = ring->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = ring->outfd;
+        sqe->buf_index = URING_BUFS + index;
+    }
+    sqe->addr = (uint64_t) (uintptr_t) (slot->buf + slot->done);
+    sqe->len = slot->want - slot->done;
+    sqe->off = slot->off + slot->done;
+    sqe->user_data = ((uint64_t) op << 32) | (uint64_t) index;
+
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+    slot->busy = true;
+}
+
+//
+// Handles one completion, continuing short transfers
+//
+static void complete(uring_t *ring, uint64_t user_data, int res) {
+    int op = (int) (user_data >> 32);
+    int index = (int) (user_data & 0xffffffff);
+    slot_t *slot = op == OP_READ ? &ring->reads[index] : &ring->writes[index];
+    slot->busy = false;
+
+    if (res == -EAGAIN || res == -EINTR) {
+        res = 0;
+    } else if (res < 0) {
+        ring->error = ring->error ? ring->error : -res;
+        return;
+    } else if (res == 0 && op == OP_READ) {
+        slot->want = slot->done; // end of file
+        return;
+    } else if (res == 0) {
+        ring->error = ring->error ? ring->error : EIO;
+        return;
+    }
+
+    slot->done += (size_t) res;
+    if (slot->done < slot->want && ring->error == 0) {
+        queue(ring, op, index);
+    }
+}
+
+//
+// Submits queued requests and waits for at least one completion
+//
+// Returns false if the ring itself failed.
+//
+static bool reap(uring_t *ring) {
+    int ret = sys_enter(ring->fd, ring->queued, 1, IORING_ENTER_GETEVENTS);
+    if (ret < 0 && errno != EINTR) {
+        ring->error = ring->error ? ring->error : errno;
+        return false;
+    }
+    if (ret > 0) {
+        ring->queued -= (unsigned) ret;
+    }
+
+    unsigned head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        complete(ring, cqe->user_data, cqe->res);
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return true;
+}
+
+//
+// Waits until no request is in flight, so every buffer is free again
+//
+static void settle(uring_t *ring) {
+    for (;;) {
+        bool busy = false;
+        for (int i = 0; i < URING_BUFS; i++) {
+            busy = busy || ring->reads[i].busy || ring->writes[i].busy;
+        }
+        if (!busy || !reap(ring)) {
+            return;
+        }
+    }
+}
+
+//
+// Sends the write slot being filled to the kernel and waits for the next one to free up
+//
+static bool flush_write(uring_t *ring) {
+    slot_t *w = &ring->writes[ring->cur_write];
+    if (w->want == 0) {
+        return true;
+    }
+
+    w->off = ring->outoff;
+    w->done = 0;
+    ring->outoff += w->want;
+    queue(ring, OP_WRITE, ring->cur_write);
+
+    ring->cur_write = (ring->cur_write + 1) % URING_BUFS;
+    slot_t *next = &ring->writes[ring->cur_write];
+    while (next->busy && ring->error == 0) {
+        if (!reap(ring)) {
+            return false;
+        }
+    }
+    next->want = 0;
+    return ring->error == 0;
+}
+
+//
+// Emit callback of the stream objects: copies output into write slots
+//
+static void emit(void *arg, const uint8_t *data, size_t len) {
+    uring_t *ring = arg;
+
+    while (len > 0 && ring->error == 0) {
+        slot_t *w = &ring->writes[ring->cur_write];
+        size_t take = URING_BUF_SIZE - w->want < len ? URING_BUF_SIZE - w->want : len;
+        memcpy(w->buf + w->want, data, take);
+        w->want += take;
+        data += take;
+        len -= take;
+
+        if (w->want == URING_BUF_SIZE) {
+            flush_write(ring);
+        }
+    }
+}
+
+static void read_chunk(uring_t *ring, uint64_t chunk, uint64_t size) {
+    int index = (int) (chunk % URING_BUFS);
+    slot_t *r = &ring->reads[index];
+    r->off = chunk * URING_BUF_SIZE;
+    r->want = size - r->off < URING_BUF_SIZE ? size - r->off : URING_BUF_SIZE;
+    r->done = 0;
+    queue(ring, OP_READ, index);
+}
+
+typedef bool feed_t(void *obj, const uint8_t *data, size_t len);
+
+//
+// Reads infd chunk by chunk, URING_BUFS chunks ahead, and feeds each one in order to obj
+//
+static bool pump(uring_t *ring, int infd, int outfd, feed_t *feed, void *obj) {
+    struct stat st;
+    if (fstat(infd, &st) != 0) {
+        return false;
+    }
+
+    ring->infd = infd;
+    ring->outfd = outfd;
+    ring->outoff = 0;
+    ring->cur_write = 0;
+    ring->error = 0;
+    for (int i = 0; i < URING_BUFS; i++) {
+        ring->writes[i].want = 0;
+    }
+
+    uint64_t size = (uint64_t) st.st_size;
+    uint64_t chunks = (size + URING_BUF_SIZE - 1) / URING_BUF_SIZE;
+    for (uint64_t c = 0; c < chunks && c < URING_BUFS; c++) {
+        read_chunk(ring, c, size);
+    }
+
+    for (uint64_t next = 0; next < chunks; next++) {
+        slot_t *r = &ring->reads[next % URING_BUFS];
+        while (r->busy && ring->error == 0) {
+            if (!reap(ring)) {
+                return false;
+            }
+        }
+        if (ring->error != 0 || !feed(obj, r->buf, r->done) || ring->error != 0) {
+            return false;
+        }
+        if (next + URING_BUFS < chunks) {
+            read_chunk(ring, next + URING_BUFS, size);
+        }
+    }
+    return true;
+}
+
+//
+// Flushes the last write and waits for everything in flight
+//
+static bool finish(uring_t *ring, bool ok) {
+    if (ok) {
+        ok = flush_write(ring);
+    }
+    settle(ring);
+    if (ring->error != 0) {
+        errno = ring->error;
+        return false;
+    }
+    return ok;
+}
+
+static bool feed_encrypt(void *obj, const uint8_t *data, size_t len) {
+    return ss_encryptor_update(obj, data, len);
+}
+
+static bool feed_decrypt(void *obj, const uint8_t *data, size_t len) {
+    return ss_decryptor_update(obj, data, len);
+}
+
+//
+// Encrypts regular file infd into regular file outfd, starting at offset 0 of both.
+//
+bool uring_encrypt_file(uring_t *ring, int infd, int outfd, const mpz_t n) {
+    ss_encryptor_t *enc = ss_encryptor_init(n, emit, ring);
+    if (enc == NULL) {
+        return false;
+    }
+
+    bool ok = pump(ring, infd, outfd, feed_encrypt, enc);
+    ok = ss_encryptor_final(enc) && ok;
+    return finish(ring, ok);
+}
+
+//
+// Decrypts regular file infd into regular file outfd, starting at offset 0 of both.
+//
+bool uring_decrypt_file(uring_t *ring, int infd, int outfd, const mpz_t d, const mpz_t pq) {
+    ss_decryptor_t *dec = ss_decryptor_init(d, pq, emit, ring);
+    if (dec == NULL) {
+        return false;
+    }
+
+    bool ok = pump(ring, infd, outfd, feed_decrypt, dec);
+    ok = ss_decryptor_final(dec) && ok;
+    if (!ok && ring->error == 0) {
+        errno = EINVAL; // not ciphertext for this key
+    }
+    return finish(ring, ok) && ok;
+}
+
+#else
+
+uring_t *uring_open(void) {
+    return NULL;
+}
+
+void uring_close(uring_t *ring) {
+    (void) ring;
+}
+
+bool uring_encrypt_file(uring_t *ring, int infd, int outfd, const mpz_t n) {
+    (void) ring, (void) infd, (void) outfd, (void) n;
+    errno = ENOSYS;
+    return false;
+}
+
+bool uring_decrypt_file(uring_t *ring, int infd, int outfd, const mpz_t d, const mpz_t pq) {
+    (void) ring, (void) infd, (void) outfd, (void) d, (void) pq;
+    errno = ENOSYS;
+    return false;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdio.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// io_uring I/O backend for encrypting and decrypting regular files.
+//
+// Several large reads and writes are kept in flight on registered buffers while
+// the blocks in between are being exponentiated, so storage I/O overlaps with
+// computation. The output is identical to ss_encrypt_file / ss_decrypt_file.
+//
+
+typedef struct uring uring_t;
+
+//
+// Sets up a ring and its buffers.
+//
+// Returns NULL if io_uring is not available (old kernel, disabled by the system,
+// or built without io_uring headers); callers then use the stdio path.
+//
+uring_t *uring_open(void);
+
+//
+// Tears down a ring created by uring_open.
+//
+void uring_close(uring_t *ring);
+
+//
+// Returns true if fd can be driven through the ring (a regular file).
+//
+bool uring_supports(int fd);
+
+//
+// Encrypts regular file infd into regular file outfd, starting at offset 0 of both.
+//
+// Returns false on an I/O error; errno describes it.
+//
+bool uring_encrypt_file(uring_t *ring, int infd, int outfd, const mpz_t n);
+
+//
+// Decrypts regular file infd into regular file outfd, starting at offset 0 of both.
+//
+// Returns false on an I/O error or if infd is not ciphertext for this key.
+//
+bool uring_decrypt_file(uring_t *ring, int infd, int outfd, const mpz_t d, const mpz_t pq);